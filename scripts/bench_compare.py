@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Compare two ring benchmark logs and flag regressions.
+
+Each benchmark run prints a line of the form ``BENCH {json}``. Runs are
+matched on their identifying fields (name, nodes, payload, load_pct, impl,
+producers, queued, rx_chunk, rx_wake_us, tokens, whichever are present) and the tracked metrics of the new log are
+compared against the baseline log. Metrics a run does not report are skipped.
+
+Usage: bench_compare.py BASELINE.log NEW.log [--tolerance PCT]
+"""
+
+import argparse
+import json
+import sys
+
+# (path into the result, True if larger is better)
+METRICS = [
+    (("rotation_us", "p50"), False),
+    (("rotation_us", "p99"), False),
+    (("latency_us", "p50"), False),
+    (("latency_us", "p99"), False),
+    (("goodput_total_bps",), True),
+    (("ring_goodput_bps",), True),
+    (("dropped",), False),
+    (("token_hop_ns", "p50"), False),
+    (("enqueue_ns", "p50"), False),
+    (("enqueue_ns", "p99"), False),
+    (("first_desc_ns", "p50"), False),
+    (("first_desc_ns", "p99"), False),
+    (("frame_gap_ns", "p50"), False),
+    (("frame_gap_ns", "p99"), False),
+    (("line_util_ppm",), True),
+]
+
+KEY_FIELDS = ("name", "nodes", "payload", "load_pct", "impl", "producers", "queued", "rx_chunk", "tokens",
+              "rx_wake_us", "dst_hops", "mac", "cycle_us", "telemetry_nodes")
+
+
+def load(path):
+    runs = {}
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            idx = line.find("BENCH ")
+            if idx < 0:
+                continue
+            run = json.loads(line[idx + len("BENCH "):])
+            run["goodput_total_bps"] = sum(run.get("goodput_bps", []))
+            key = tuple(run.get(field, "") for field in KEY_FIELDS)
+            runs[key] = run
+    return runs
+
+
+def lookup(run, path):
+    for part in path:
+        if not isinstance(run, dict) or part not in run:
+            return None
+        run = run[part]
+    return run
+
+
+def fmt_key(key):
+    return "/".join(str(part) for part in key if part != "")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("new")
+    parser.add_argument("--tolerance", type=float, default=5.0,
+                        help="allowed change in percent before flagging (default 5)")
+    args = parser.parse_args()
+
+    base = load(args.baseline)
+    new = load(args.new)
+    regressions = 0
+
+    for key in sorted(base.keys() & new.keys()):
+        for path, higher_is_better in METRICS:
+            old_val = lookup(base[key], path)
+            new_val = lookup(new[key], path)
+            if old_val is None or new_val is None or old_val == 0:
+                continue
+            change = 100.0 * (new_val - old_val) / old_val
+            worse = -change if higher_is_better else change
+            if worse > args.tolerance:
+                regressions += 1
+                print("REGRESSION %s %s: %s -> %s (%+.1f%%)" %
+                      (fmt_key(key), ".".join(path), old_val, new_val, change))
+
+    missing = base.keys() - new.keys()
+    for key in sorted(missing):
+        print("MISSING %s" % fmt_key(key))
+
+    print("%d runs compared, %d regressions" % (len(base.keys() & new.keys()), regressions))
+    return 1 if regressions or missing else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
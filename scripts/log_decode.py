@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+"""Decode dictionary-based log output captured from the RTT log channel.
+
+With CONFIG_LOG_DICTIONARY_SUPPORT the target only emits format string
+addresses and raw arguments; the strings live in the build's
+log_dictionary.json. This wraps Zephyr's dictionary log parser so a
+captured RTT stream can be turned back into text.
+
+Usage: log_decode.py CAPTURE [--build-dir build] [--hex]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="binary (or hex with --hex) capture of RTT channel 0")
+    parser.add_argument("--build-dir", default="build",
+                        help="build directory containing zephyr/log_dictionary.json")
+    parser.add_argument("--hex", action="store_true",
+                        help="capture is a hex string rather than raw bytes")
+    args = parser.parse_args()
+
+    zephyr_base = os.environ.get("ZEPHYR_BASE")
+    if not zephyr_base:
+        sys.exit("ZEPHYR_BASE is not set; source zephyr-env.sh first")
+
+    db = os.path.join(args.build_dir, "zephyr", "log_dictionary.json")
+    if not os.path.isfile(db):
+        sys.exit("%s not found; was the image built with CONFIG_LOG_DICTIONARY_SUPPORT?" % db)
+
+    cmd = [sys.executable,
+           os.path.join(zephyr_base, "scripts", "logging", "dictionary", "log_parser.py"),
+           db, args.capture]
+    if args.hex:
+        cmd.append("--hex")
+
+    return subprocess.call(cmd)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
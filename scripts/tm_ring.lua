@@ -0,0 +1,206 @@
+-- Wireshark dissector for token-ring captures (CONFIG_TOKEN_MANAGER_CAPTURE).
+--
+-- Install by copying into the Wireshark personal plugins folder, or run
+--   wireshark -X lua_script:scripts/tm_ring.lua tm_capture.pcap
+--
+-- Display filter examples:
+--   tmring.node == 2                 frames seen by node 2
+--   tmring.type == 0xbb && tmring.src == 1
+--   tmring.bad_crc                   frames that failed the CRC check
+--
+-- Nodes pass process data frames on as they arrive, without assembling
+-- them, so only their origin captures them.
+
+local p = Proto("tmring", "UART Token Ring")
+
+local frame_types = {
+    [0xAA] = "Token", [0xAB] = "Aggregating token", [0xAC] = "Reporting token", [0xAD] = "Sync",
+    [0xAE] = "Telemetry token", [0xBB] = "Data", [0xBC] = "Addressed data", [0xCC] = "Diagnostic",
+    [0xDD] = "Process data", [0xEE] = "Slot",
+}
+local diag_kinds = {
+    [0x01] = "Histogram request", [0x81] = "Histogram response",
+    [0x02] = "Stats request", [0x82] = "Stats response",
+    [0x03] = "Collect",
+}
+
+local f = p.fields
+f.version  = ProtoField.uint8("tmring.version", "Capture version")
+f.node     = ProtoField.uint8("tmring.node", "Capturing node")
+f.flags    = ProtoField.uint8("tmring.flags", "Flags", base.HEX)
+f.bad_crc  = ProtoField.bool("tmring.bad_crc", "CRC error", 8, nil, 0x01)
+f.malformed = ProtoField.bool("tmring.malformed", "Malformed", 8, nil, 0x02)
+f.type     = ProtoField.uint8("tmring.type", "Frame type", base.HEX, frame_types)
+f.token_id = ProtoField.uint8("tmring.token_id", "Token ID")
+f.src      = ProtoField.uint8("tmring.src", "Source node")
+f.dst      = ProtoField.uint8("tmring.dst", "Destination node")
+f.slot     = ProtoField.uint8("tmring.slot", "Slot number", base.DEC, nil, 0x3F)
+f.full     = ProtoField.bool("tmring.slot_full", "Full", 8, nil, 0x80)
+f.monitor  = ProtoField.bool("tmring.slot_monitor", "Monitor passed", 8, nil, 0x40)
+f.hops     = ProtoField.uint8("tmring.sync_hops", "Hops")
+f.sync_seq = ProtoField.uint8("tmring.sync_seq", "Sequence")
+f.origin   = ProtoField.uint32("tmring.sync_origin", "Origin (us)")
+f.correction = ProtoField.uint32("tmring.sync_correction", "Correction (us)")
+f.hop_us   = ProtoField.uint16("tmring.sync_hop_us", "Hop delay (us)")
+f.kind     = ProtoField.uint8("tmring.kind", "Diagnostic kind", base.HEX, diag_kinds)
+f.wkc      = ProtoField.uint8("tmring.wkc", "Working counter")
+f.fields   = ProtoField.uint8("tmring.agg_fields", "Aggregation fields")
+f.seen     = ProtoField.uint8("tmring.seen", "Seen reports")
+f.telem    = ProtoField.uint8("tmring.telem_nodes", "Telemetry slots")
+f.telem_hold = ProtoField.uint16("tmring.telem_hold", "Hold (us)")
+f.telem_fwd = ProtoField.uint16("tmring.telem_fwd", "Forwarding delay (us)")
+f.len      = ProtoField.uint8("tmring.len", "Payload length")
+f.payload  = ProtoField.bytes("tmring.payload", "Payload")
+f.crc      = ProtoField.uint16("tmring.crc", "CRC16", base.HEX)
+
+function p.dissector(buf, pinfo, tree)
+    if buf:len() < 4 then
+        return 0
+    end
+
+    pinfo.cols.protocol = "TMRING"
+    local t = tree:add(p, buf())
+    local flags = buf(2, 1)
+
+    t:add(f.version, buf(0, 1))
+    t:add(f.node, buf(1, 1))
+    local ft = t:add(f.flags, flags)
+    ft:add(f.bad_crc, flags)
+    ft:add(f.malformed, flags)
+
+    local fr = buf(4):tvb()
+    local n = fr:len()
+    if n < 1 then
+        return buf:len()
+    end
+
+    local ty = fr(0, 1):uint()
+    local hdr, body
+    -- Bytes between the payload and the CRC
+    local trail = 0
+    t:add(f.type, fr(0, 1))
+
+    if ty == 0xAA and n >= 4 then
+        t:add(f.token_id, fr(1, 1))
+        hdr = 2
+        body = 2
+        pinfo.cols.info = string.format("Token id=%d", fr(1, 1):uint())
+    elseif ty == 0xAB and n >= 5 then
+        t:add(f.token_id, fr(1, 1))
+        t:add(f.fields, fr(2, 1))
+        hdr = 3
+        body = hdr + 9 * fr(2, 1):uint()
+        pinfo.cols.info = string.format("Token id=%d, %d aggregates", fr(1, 1):uint(),
+                                        fr(2, 1):uint())
+    elseif ty == 0xAC and n >= 6 then
+        t:add(f.token_id, fr(1, 1))
+        t:add(f.fields, fr(2, 1))
+        t:add(f.seen, fr(3, 1))
+        hdr = 4
+        body = hdr + 9 * fr(2, 1):uint() + 3 * fr(3, 1):uint()
+        pinfo.cols.info = string.format("Token id=%d, %d aggregates, %d seen reports",
+                                        fr(1, 1):uint(), fr(2, 1):uint(), fr(3, 1):uint())
+    elseif ty == 0xAE and n >= 7 then
+        local nodes = fr(4, 1):uint()
+        t:add(f.token_id, fr(1, 1))
+        t:add(f.fields, fr(2, 1))
+        t:add(f.seen, fr(3, 1))
+        local tt = t:add(f.telem, fr(4, 1))
+        hdr = 5
+        body = hdr + 9 * fr(2, 1):uint() + 3 * fr(3, 1):uint()
+        -- One slot per node ID, 0xFFFF where a time is unknown
+        for i = 0, nodes - 1 do
+            if body + 4 <= n then
+                local st = tt:add(fr(body, 4), string.format("Node %d", i))
+                st:add(f.telem_hold, fr(body, 2))
+                st:add(f.telem_fwd, fr(body + 2, 2))
+            end
+            body = body + 4
+        end
+        pinfo.cols.info = string.format("Token id=%d, %d aggregates, %d seen reports, %d nodes",
+                                        fr(1, 1):uint(), fr(2, 1):uint(), fr(3, 1):uint(), nodes)
+    elseif ty == 0xAD and n >= 15 then
+        t:add(f.hops, fr(1, 1))
+        t:add(f.sync_seq, fr(2, 1))
+        t:add(f.origin, fr(3, 4))
+        t:add(f.correction, fr(7, 4))
+        t:add(f.hop_us, fr(11, 2))
+        hdr = 13
+        body = hdr
+        pinfo.cols.info = string.format("Sync seq=%d origin=%d hops=%d correction=%d",
+                                        fr(2, 1):uint(), fr(3, 4):uint(), fr(1, 1):uint(),
+                                        fr(7, 4):uint())
+    elseif ty == 0xBC and n >= 6 then
+        local len = fr(2, 1):uint()
+        t:add(f.src, fr(1, 1))
+        t:add(f.len, fr(2, 1))
+        hdr = 3
+        body = hdr + len + 1
+        trail = 1
+        if body <= n then
+            t:add(f.dst, fr(body - 1, 1))
+        end
+        pinfo.cols.info = string.format("Data %d -> %s len=%d", fr(1, 1):uint(),
+                                        body <= n and fr(body - 1, 1):uint() or "?", len)
+    elseif ty == 0xEE and n >= 7 then
+        local ctrl = fr(1, 1)
+        t:add(f.slot, ctrl)
+        t:add(f.full, ctrl)
+        t:add(f.monitor, ctrl)
+        t:add(f.src, fr(2, 1))
+        t:add(f.dst, fr(3, 1))
+        t:add(f.len, fr(4, 1))
+        hdr = 5
+        -- The payload is padded out to the slot size
+        body = math.max(n - 2, hdr + fr(4, 1):uint())
+        trail = body - hdr - fr(4, 1):uint()
+        if bit.band(ctrl:uint(), 0x80) == 0 then
+            pinfo.cols.info = string.format("Slot %d empty", bit.band(ctrl:uint(), 0x3F))
+        else
+            pinfo.cols.info = string.format("Slot %d %d -> %d len=%d", bit.band(ctrl:uint(), 0x3F),
+                                            fr(2, 1):uint(), fr(3, 1):uint(), fr(4, 1):uint())
+        end
+    elseif ty == 0xBB and n >= 5 then
+        t:add(f.src, fr(1, 1))
+        t:add(f.len, fr(2, 1))
+        hdr = 3
+        body = hdr + fr(2, 1):uint()
+        pinfo.cols.info = string.format("Data src=%d len=%d", fr(1, 1):uint(), fr(2, 1):uint())
+    elseif ty == 0xCC and n >= 7 then
+        t:add(f.src, fr(1, 1))
+        t:add(f.dst, fr(2, 1))
+        t:add(f.kind, fr(3, 1))
+        t:add(f.len, fr(4, 1))
+        hdr = 5
+        body = hdr + fr(4, 1):uint()
+        pinfo.cols.info = string.format("Diag %d -> %d %s", fr(1, 1):uint(), fr(2, 1):uint(),
+                                        diag_kinds[fr(3, 1):uint()] or "kind?")
+    elseif ty == 0xDD and n >= 6 then
+        t:add(f.src, fr(1, 1))
+        t:add(f.wkc, fr(2, 1))
+        t:add(f.len, fr(3, 1))
+        hdr = 4
+        body = hdr + fr(3, 1):uint()
+        pinfo.cols.info = string.format("Process data src=%d wkc=%d len=%d", fr(1, 1):uint(),
+                                        fr(2, 1):uint(), fr(3, 1):uint())
+    else
+        pinfo.cols.info = "Malformed"
+        return buf:len()
+    end
+
+    if body + 2 > n then
+        return buf:len()
+    end
+    if body - trail > hdr then
+        t:add(f.payload, fr(hdr, body - trail - hdr))
+    end
+    t:add(f.crc, fr(body, 2))
+
+    if flags:uint() ~= 0 then
+        pinfo.cols.info:append(" [bad]")
+    end
+
+    return buf:len()
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, p)
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Decode a token manager binary trace stream.
+
+The stream is produced with CONFIG_TOKEN_MANAGER_TRACE, either captured from
+the RTT trace channel (e.g. with JLinkRTTLogger) or written to a file on
+native_sim. See subsys/token_management/include/tm_trace.h for the format.
+
+Usage:
+  tm_trace_decode.py trace.bin             print the event timeline
+  tm_trace_decode.py trace.bin --summary   time spent in each state per node
+  tm_trace_decode.py trace.bin --isr       UART callback duration per event type
+"""
+
+import argparse
+import collections
+import struct
+import sys
+
+EVENTS = [
+    "NONE", "STATE", "TOKEN_RX", "DATA_RX", "FRAME_DROP", "TX", "TOKEN_REGEN",
+    "UART_RX_RDY", "UART_RX_BUF_REQ", "UART_RX_DISABLED", "UART_TX_DONE",
+    "UART_TX_ABORTED", "UART_OTHER", "UART_CB_EXIT",
+]
+UART_EVENTS = ["TX_DONE", "TX_ABORTED", "RX_RDY", "RX_BUF_REQUEST", "RX_BUF_RELEASED",
+               "RX_DISABLED", "RX_STOPPED"]
+STATES = ["IDLE", "TOKEN_RECEIVED", "DATA_TRANSMISSION", "TOKEN_FORWARDING", "ERROR_RECOVERY"]
+
+STREAM_HDR = struct.Struct("<4sBBHI")
+BLOCK_HDR = struct.Struct("<BBHI")
+BLOCK_MAGIC = 0xB1
+
+
+def parse(data):
+    magic, version, rec_size, _, hz = STREAM_HDR.unpack_from(data, 0)
+    if magic != b"TMTR" or version != 1:
+        sys.exit("not a tm_trace stream (magic %r, version %d)" % (magic, version))
+    rec = struct.Struct("<IHBB")
+    if rec_size != rec.size:
+        sys.exit("unexpected record size %d" % rec_size)
+
+    records = []
+    lost = 0
+    pos = STREAM_HDR.size
+    while pos + BLOCK_HDR.size <= len(data):
+        block_magic, cpu, count, block_lost = BLOCK_HDR.unpack_from(data, pos)
+        if block_magic != BLOCK_MAGIC:
+            sys.exit("stream out of sync at offset %d" % pos)
+        pos += BLOCK_HDR.size
+        lost += block_lost
+        for _ in range(count):
+            if pos + rec.size > len(data):
+                break
+            cycles, arg, event, node = rec.unpack_from(data, pos)
+            records.append((cpu, cycles, event, node, arg))
+            pos += rec.size
+    return hz, records, lost
+
+
+def unwrap(records):
+    """Turn 32-bit cycle stamps into monotonic 64-bit ones per CPU."""
+    last = {}
+    base = collections.defaultdict(int)
+    out = []
+    for cpu, cycles, event, node, arg in records:
+        if cpu in last and cycles < last[cpu]:
+            base[cpu] += 1 << 32
+        last[cpu] = cycles
+        out.append((base[cpu] + cycles, cpu, event, node, arg))
+    return out
+
+
+def describe(event, arg):
+    name = EVENTS[event] if event < len(EVENTS) else "EVENT_%d" % event
+    if name == "STATE":
+        return "STATE %s" % (STATES[arg] if arg < len(STATES) else arg)
+    if name == "DATA_RX":
+        return "DATA_RX src=%d len=%d" % (arg >> 8, arg & 0xFF)
+    return "%s %d" % (name, arg)
+
+
+def timeline(hz, records):
+    start = records[0][0] if records else 0
+    prev = start
+    for ts, cpu, event, node, arg in records:
+        node_str = "hal" if node == 0xFF else "n%d" % node
+        print("%12.3f us  +%9.3f  cpu%d %-4s %s" % ((ts - start) * 1e6 / hz,
+                                                  (ts - prev) * 1e6 / hz,
+                                                  cpu, node_str, describe(event, arg)))
+        prev = ts
+
+
+def summary(hz, records):
+    dwell = collections.defaultdict(lambda: collections.Counter())
+    current = {}
+    for ts, _, event, node, arg in records:
+        if EVENTS[event] != "STATE":
+            continue
+        if node in current:
+            state, since = current[node]
+            dwell[node][state] += ts - since
+        current[node] = (arg, ts)
+
+    for node in sorted(dwell):
+        total = sum(dwell[node].values()) or 1
+        print("node %d" % node)
+        for state, cycles in sorted(dwell[node].items()):
+            name = STATES[state] if state < len(STATES) else str(state)
+            print("  %-18s %12.1f us  %5.1f%%" % (name, cycles * 1e6 / hz, 100.0 * cycles / total))
+
+
+def isr_times(hz, records):
+    """Pair each UART callback entry with its UART_CB_EXIT record."""
+    durations = collections.defaultdict(list)
+    entry = {}
+    exit_id = EVENTS.index("UART_CB_EXIT")
+    for ts, cpu, event, node, arg in records:
+        if node != 0xFF:
+            continue
+        if event == exit_id:
+            if cpu in entry:
+                durations[arg].append(ts - entry.pop(cpu))
+        elif EVENTS[event].startswith("UART_"):
+            entry[cpu] = ts
+
+    for evt_type in sorted(durations):
+        samples = sorted(durations[evt_type])
+        name = UART_EVENTS[evt_type] if evt_type < len(UART_EVENTS) else str(evt_type)
+        us = [c * 1e6 / hz for c in samples]
+        print("%-16s n=%-7d mean %8.2f us  p50 %8.2f us  p99 %8.2f us  max %8.2f us" % (
+            name, len(us), sum(us) / len(us), us[len(us) // 2],
+            us[min(len(us) - 1, len(us) * 99 // 100)], us[-1]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace")
+    parser.add_argument("--summary", action="store_true",
+                        help="print per-node state dwell times instead of the timeline")
+    parser.add_argument("--isr", action="store_true",
+                        help="print UART callback durations instead of the timeline")
+    args = parser.parse_args()
+
+    with open(args.trace, "rb") as f:
+        hz, records, lost = parse(f.read())
+    records = unwrap(records)
+
+    if args.summary:
+        summary(hz, records)
+    elif args.isr:
+        isr_times(hz, records)
+    else:
+        timeline(hz, records)
+    print("%d records, %d lost, %d Hz cycle counter" % (len(records), lost, hz), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,361 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include "hal_uart.h"
+#include "tm_trace.h"
+
+LOG_MODULE_REGISTER(hal_uart, CONFIG_TOKEN_RING_HAL_LOG_LEVEL);
+
+#define HAL_UART_RX_RING_SIZE  512
+#define HAL_UART_TX_BUF_SIZE   1024
+#define HAL_UART_TX_DESCS      8
+
+#define HAL_UART_NODE          DT_NODELABEL(uart0)
+#define HAL_UART_BAUD          DT_PROP(HAL_UART_NODE, current_speed)
+/* One byte time (10 bit times) at the devicetree baud rate, plus a bit time of margin */
+#define HAL_UART_RX_TIMEOUT_US DIV_ROUND_UP(11 * USEC_PER_SEC, HAL_UART_BAUD)
+
+static const struct device *const uart_dev = DEVICE_DT_GET(HAL_UART_NODE);
+
+static uint8_t rx_buf[2][CONFIG_TOKEN_RING_RX_CHUNK];
+static int current_buf = 0;
+
+/*
+ * Pending transmissions, in order. A descriptor either stands for bytes
+ * copied into one of the TX buffers (segs == NULL) or for a caller's
+ * segment chain, sent in place.
+ */
+struct hal_uart_tx_desc {
+    const struct hal_uart_seg *segs;
+    size_t n_segs;
+    /* Copied bytes in tx_bufs[buf], and how many of them have been sent */
+    uint8_t buf;
+    uint32_t len;
+    uint32_t sent;
+    hal_uart_tx_done_t done;
+    void *user_data;
+};
+
+RING_BUF_DECLARE(rx_ring, HAL_UART_RX_RING_SIZE);
+static K_SEM_DEFINE(rx_sem, 0, 1);
+
+/*
+ * The reader is blocked in hal_uart_wait_rx(). It takes rx_lock to leave,
+ * so it waits for an RX hook running meanwhile to return.
+ */
+static struct k_spinlock rx_lock;
+static bool rx_parked;
+static hal_uart_rx_hook_t rx_hook;
+static void *rx_hook_data;
+
+/*
+ * Copied writes are double buffered: while one buffer is on the wire the
+ * next is filled, and it is started straight from the first one's TX_DONE.
+ * Each buffer goes out as one contiguous transfer.
+ */
+static uint8_t tx_bufs[2][HAL_UART_TX_BUF_SIZE];
+static bool tx_buf_used[2];
+
+/* The descriptor queue, buffers and tx_busy are shared with the UART callback */
+static struct k_spinlock tx_lock;
+static struct hal_uart_tx_desc tx_descs[HAL_UART_TX_DESCS];
+static uint32_t tx_head;
+static uint32_t tx_tail;
+/* Next segment of the head descriptor */
+static size_t tx_seg;
+static bool tx_busy;
+
+/* Updated from the UART callback, read by the token manager thread */
+static atomic_t rx_overruns;
+static atomic_t buf_misses;
+
+/*
+ * Account for len bytes of the head descriptor having been sent. Returns
+ * the descriptor if it is now complete, so its done callback can run once
+ * the lock is dropped. Called with tx_lock held.
+ */
+static struct hal_uart_tx_desc *hal_uart_tx_advance(uint32_t len)
+{
+    struct hal_uart_tx_desc *desc = &tx_descs[tx_head % HAL_UART_TX_DESCS];
+
+    if (desc->segs == NULL) {
+        desc->sent += len;
+        if (desc->sent < desc->len) {
+            return NULL;
+        }
+        tx_buf_used[desc->buf] = false;
+    } else if (++tx_seg < desc->n_segs) {
+        return NULL;
+    }
+
+    tx_seg = 0;
+    tx_head++;
+
+    return desc;
+}
+
+/*
+ * Start a transfer of the next chunk, unless one is already in flight:
+ * the unsent part of a TX buffer, or the next segment of a chain. Called from
+ * both thread and UART callback context, so chained segments go out back
+ * to back from TX_DONE without waking a thread.
+ */
+static void hal_uart_tx_kick(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&tx_lock);
+
+    while (!tx_busy && tx_head != tx_tail) {
+        struct hal_uart_tx_desc *desc = &tx_descs[tx_head % HAL_UART_TX_DESCS];
+        struct hal_uart_tx_desc *done;
+        const uint8_t *data;
+        uint32_t len;
+
+        if (desc->segs == NULL) {
+            data = &tx_bufs[desc->buf][desc->sent];
+            len = desc->len - desc->sent;
+        } else {
+            data = desc->segs[tx_seg].buf;
+            len = desc->segs[tx_seg].len;
+        }
+
+        if (len > 0) {
+            tx_busy = true;
+            k_spin_unlock(&tx_lock, key);
+            int ret = uart_tx(uart_dev, data, len, SYS_FOREVER_MS);
+            key = k_spin_lock(&tx_lock);
+            if (ret == 0) {
+                break;
+            }
+            LOG_ERR("uart_tx failed: %d", ret);
+            tx_busy = false;
+        }
+
+        /* Failed or empty: drop the chunk and move on */
+        done = hal_uart_tx_advance(len);
+        if (done != NULL && done->done != NULL) {
+            k_spin_unlock(&tx_lock, key);
+            done->done(done->user_data);
+            key = k_spin_lock(&tx_lock);
+        }
+    }
+
+    k_spin_unlock(&tx_lock, key);
+}
+
+/* TX_DONE or TX_ABORTED: retire what was sent and start the next chunk */
+static void hal_uart_tx_complete(uint32_t len)
+{
+    k_spinlock_key_t key = k_spin_lock(&tx_lock);
+    struct hal_uart_tx_desc *done = hal_uart_tx_advance(len);
+
+    tx_busy = false;
+    k_spin_unlock(&tx_lock, key);
+
+    if (done != NULL && done->done != NULL) {
+        done->done(done->user_data);
+    }
+    hal_uart_tx_kick();
+}
+
+/*
+ * Payload dumps are far too expensive for the RX path, so only every Nth
+ * chunk is logged, and the whole thing compiles away when N is 0.
+ */
+static inline void hal_uart_rx_dump(const uint8_t *data, size_t len)
+{
+#if CONFIG_TOKEN_RING_RX_DUMP_INTERVAL > 0
+    static uint32_t rx_chunks;
+
+    if (++rx_chunks % CONFIG_TOKEN_RING_RX_DUMP_INTERVAL == 0) {
+        LOG_HEXDUMP_DBG(data, len, "RX sample");
+    }
+#endif
+}
+
+/* Offer a chunk to the RX hook; true if it took it */
+static bool hal_uart_rx_hooked(const uint8_t *data, size_t len)
+{
+    k_spinlock_key_t key = k_spin_lock(&rx_lock);
+    bool taken = rx_hook != NULL && rx_parked && ring_buf_is_empty(&rx_ring) &&
+                 rx_hook(data, len, rx_hook_data);
+
+    k_spin_unlock(&rx_lock, key);
+
+    return taken;
+}
+
+static void uart_cb(const struct device *dev, struct uart_event *evt, void *user_data)
+{
+    switch (evt->type) {
+    case UART_RX_RDY:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_RX_RDY, evt->data.rx.len);
+        hal_uart_rx_dump(evt->data.rx.buf + evt->data.rx.offset, evt->data.rx.len);
+        if (hal_uart_rx_hooked(evt->data.rx.buf + evt->data.rx.offset, evt->data.rx.len)) {
+            break;
+        }
+        if (ring_buf_put(&rx_ring, evt->data.rx.buf + evt->data.rx.offset,
+                         evt->data.rx.len) < evt->data.rx.len) {
+            atomic_inc(&buf_misses);
+            LOG_WRN("RX ring overrun");
+        }
+        k_sem_give(&rx_sem);
+        break;
+    case UART_RX_BUF_REQUEST:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_RX_BUF_REQ, 0);
+        /* Provide a new buffer when requested */
+        current_buf = (current_buf + 1) % 2;
+        uart_rx_buf_rsp(dev, rx_buf[current_buf], sizeof(rx_buf[current_buf]));
+        break;
+    case UART_RX_BUF_RELEASED:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_OTHER, evt->type);
+        /* The previously used RX buffer is released here. Nothing special needed if double-buffering. */
+        break;
+    case UART_RX_STOPPED:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_OTHER, evt->type);
+        if (evt->data.rx_stop.reason & UART_ERROR_OVERRUN) {
+            atomic_inc(&rx_overruns);
+        }
+        LOG_WRN("RX stopped: 0x%x", evt->data.rx_stop.reason);
+        break;
+    case UART_RX_DISABLED:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_RX_DISABLED, 0);
+        LOG_WRN("RX disabled");
+        break;
+    case UART_TX_DONE:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_TX_DONE, evt->data.tx.len);
+        hal_uart_tx_complete(evt->data.tx.len);
+        break;
+    case UART_TX_ABORTED:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_TX_ABORTED, evt->data.tx.len);
+        LOG_ERR("TX aborted");
+        hal_uart_tx_complete(evt->data.tx.len);
+        break;
+    default:
+        TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_OTHER, evt->type);
+        LOG_DBG("Unhandled UART event: %d", evt->type);
+        break;
+    }
+
+    TM_TRACE(TM_TRACE_NODE_HAL, TM_TRACE_UART_CB_EXIT, evt->type);
+}
+
+int hal_uart_init(void)
+{
+    if (!device_is_ready(uart_dev)) {
+        LOG_ERR("UART device not ready");
+        return -ENODEV;
+    }
+
+    uart_callback_set(uart_dev, uart_cb, NULL);
+
+    /* Enable RX with the first buffer; a short idle gap flushes a partial one */
+    int ret = uart_rx_enable(uart_dev, rx_buf[0], sizeof(rx_buf[0]), HAL_UART_RX_TIMEOUT_US);
+    if (ret < 0) {
+        LOG_ERR("Failed to enable UART RX: %d", ret);
+        return ret;
+    }
+
+    return 0;
+}
+
+int hal_uart_write(const uint8_t *data, size_t len)
+{
+    k_spinlock_key_t key = k_spin_lock(&tx_lock);
+    struct hal_uart_tx_desc *last = &tx_descs[(tx_tail - 1) % HAL_UART_TX_DESCS];
+    /* A buffer can be extended until its transfer has started */
+    bool open = tx_head != tx_tail && last->segs == NULL &&
+                !(tx_busy && tx_tail - tx_head == 1);
+
+    if (!open || last->len + len > HAL_UART_TX_BUF_SIZE) {
+        int buf = !tx_buf_used[0] ? 0 : !tx_buf_used[1] ? 1 : -1;
+
+        if (buf < 0 || len > HAL_UART_TX_BUF_SIZE || tx_tail - tx_head == HAL_UART_TX_DESCS) {
+            k_spin_unlock(&tx_lock, key);
+            atomic_inc(&buf_misses);
+            return -ENOMEM;
+        }
+        tx_buf_used[buf] = true;
+        last = &tx_descs[tx_tail++ % HAL_UART_TX_DESCS];
+        *last = (struct hal_uart_tx_desc){.buf = buf};
+    }
+
+    memcpy(&tx_bufs[last->buf][last->len], data, len);
+    last->len += len;
+    k_spin_unlock(&tx_lock, key);
+
+    hal_uart_tx_kick();
+
+    return 0;
+}
+
+int hal_uart_write_gather(const struct hal_uart_seg *segs, size_t n, hal_uart_tx_done_t done,
+                          void *user_data)
+{
+    k_spinlock_key_t key = k_spin_lock(&tx_lock);
+
+    if (n == 0 || tx_tail - tx_head == HAL_UART_TX_DESCS) {
+        k_spin_unlock(&tx_lock, key);
+        return n == 0 ? -EINVAL : -ENOMEM;
+    }
+
+    tx_descs[tx_tail++ % HAL_UART_TX_DESCS] = (struct hal_uart_tx_desc){
+        .segs = segs,
+        .n_segs = n,
+        .done = done,
+        .user_data = user_data,
+    };
+    k_spin_unlock(&tx_lock, key);
+
+    hal_uart_tx_kick();
+
+    return 0;
+}
+
+int hal_uart_read(uint8_t *buf, size_t *len)
+{
+    *len = ring_buf_get(&rx_ring, buf, *len);
+
+    return 0;
+}
+
+int hal_uart_wait_rx(k_timeout_t timeout)
+{
+    k_spinlock_key_t key = k_spin_lock(&rx_lock);
+
+    rx_parked = true;
+    k_spin_unlock(&rx_lock, key);
+
+    int ret = k_sem_take(&rx_sem, timeout);
+
+    key = k_spin_lock(&rx_lock);
+    rx_parked = false;
+    k_spin_unlock(&rx_lock, key);
+
+    return ret;
+}
+
+void hal_uart_set_rx_hook(hal_uart_rx_hook_t hook, void *user_data)
+{
+    k_spinlock_key_t key = k_spin_lock(&rx_lock);
+
+    rx_hook = hook;
+    rx_hook_data = user_data;
+    k_spin_unlock(&rx_lock, key);
+}
+
+void hal_uart_wake(void)
+{
+    k_sem_give(&rx_sem);
+}
+
+void hal_uart_stats_get(uint32_t *overruns, uint32_t *misses)
+{
+    *overruns = (uint32_t)atomic_get(&rx_overruns);
+    *misses = (uint32_t)atomic_get(&buf_misses);
+}
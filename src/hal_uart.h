@@ -0,0 +1,76 @@
+/*
+ * UART hardware abstraction layer (design document, section 7.1).
+ *
+ * Wraps the Zephyr async UART API: received bytes are collected into an RX
+ * ring buffer from the UART callback, unless an RX hook handles them there
+ * and then. Writes are either copied into one of
+ * two TX buffers, filled while the other is on the wire, or, for
+ * scatter-gather writes, sent in place; both are drained in order by
+ * back-to-back uart_tx() calls issued from the TX_DONE callback.
+ */
+
+#ifndef HAL_UART_H_
+#define HAL_UART_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+int hal_uart_init(void);
+
+/* Queue bytes for transmission. Returns -ENOMEM if the TX buffers are full. */
+int hal_uart_write(const uint8_t *data, size_t len);
+
+/* One piece of a scatter-gather write */
+struct hal_uart_seg {
+    const uint8_t *buf;
+    size_t len;
+};
+
+/* Called, possibly from interrupt context, once a gather write has gone out */
+typedef void (*hal_uart_tx_done_t)(void *user_data);
+
+/*
+ * Queue n segments for transmission in place, behind anything already
+ * queued. segs and the data they point to must stay untouched until done
+ * is called. The async UART API has no chained DMA, so each segment is a
+ * separate uart_tx() started from the previous one's TX_DONE.
+ * Returns -ENOMEM if too many writes are pending.
+ */
+int hal_uart_write_gather(const struct hal_uart_seg *segs, size_t n, hal_uart_tx_done_t done,
+                          void *user_data);
+
+/* Copy up to *len received bytes into buf; *len is updated to the count read */
+int hal_uart_read(uint8_t *buf, size_t *len);
+
+/*
+ * Block until received bytes are pending or the timeout expires. Call it
+ * only once everything read so far has been handled, as the RX hook relies
+ * on that.
+ */
+int hal_uart_wait_rx(k_timeout_t timeout);
+
+/*
+ * Called from the UART callback with a received chunk, but only while the
+ * RX ring is empty and a reader is blocked in hal_uart_wait_rx(), so that
+ * nothing received earlier is still waiting to be handled and the reader
+ * cannot run until the hook returns. Returning true consumes the chunk: it
+ * is not queued and the reader is not woken.
+ */
+typedef bool (*hal_uart_rx_hook_t)(const uint8_t *data, size_t len, void *user_data);
+
+/* Install or, with NULL, remove the RX hook */
+void hal_uart_set_rx_hook(hal_uart_rx_hook_t hook, void *user_data);
+
+/* Make the current or next hal_uart_wait_rx() return early. Safe from interrupt context. */
+void hal_uart_wake(void);
+
+/*
+ * Link error counters: hardware RX overruns, and chunks dropped because the
+ * RX ring or the TX buffers were full.
+ */
+void hal_uart_stats_get(uint32_t *rx_overruns, uint32_t *buf_misses);
+
+#endif /* HAL_UART_H_ */
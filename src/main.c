@@ -1,65 +1,261 @@
 #include <zephyr/kernel.h>
-#include <zephyr/device.h>
-#include <zephyr/devicetree.h>
-#include <zephyr/drivers/uart.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "hal_uart.h"
+#include "tm_diag.h"
+#include "token_manager.h"
 
 LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 
-static uint8_t rx_buf[2][64];
-static int current_buf = 0;
+#define TM_THREAD_STACK_SIZE  2048
+#define TM_THREAD_PRIORITY    2
+#define APP_THREAD_STACK_SIZE 1024
+#define APP_THREAD_PRIORITY   5
+
+#define TM_TICK_MS         10
+#define SENSOR_PERIOD_MS   100
+/* Message type of sensor readings, the first payload byte */
+#define APP_MSG_SENSOR     0x01
+
+#ifdef CONFIG_TOKEN_RING_TOKENS
+/* Caught here rather than by token_manager_init() at boot */
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_TOKEN_RING_TOKENS), "TOKEN_RING_TOKENS must be a power of two");
+#endif
+
+static struct token_manager tm;
+static int sensor_mbox;
 
-static void uart_cb(const struct device *dev, struct uart_event *evt, void *user_data)
+static int port_tx(void *ctx, const uint8_t *buf, size_t len)
 {
-    switch (evt->type) {
-    case UART_RX_RDY:
-        LOG_INF("Received %d bytes: %.*s", evt->data.rx.len, evt->data.rx.len,
-                evt->data.rx.buf + evt->data.rx.offset);
-        break;
-    case UART_RX_BUF_REQUEST:
-        /* Provide a new buffer when requested */
-        current_buf = (current_buf + 1) % 2;
-        uart_rx_buf_rsp(dev, rx_buf[current_buf], sizeof(rx_buf[current_buf]));
-        break;
-    case UART_RX_BUF_RELEASED:
-        /* The previously used RX buffer is released here. Nothing special needed if double-buffering. */
-        break;
-    case UART_RX_DISABLED:
-        LOG_WRN("RX disabled");
-        break;
-    case UART_TX_DONE:
-        LOG_INF("TX complete");
+    return hal_uart_write(buf, len);
+}
+
+/* The token manager keeps at most one gather write outstanding */
+static struct hal_uart_seg port_segs[TM_TX_SEGS];
+
+static void port_tx_done(void *user_data)
+{
+    token_manager_tx_done(user_data);
+#ifdef CONFIG_TOKEN_RING_MAC_INSERTION
+    /* The line is free: let the token manager thread send the next frame */
+    hal_uart_wake();
+#endif
+}
+
+static int port_tx_gather(void *ctx, const struct token_manager_tx_seg *segs, size_t n)
+{
+    if (n > ARRAY_SIZE(port_segs)) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        port_segs[i].buf = segs[i].buf;
+        port_segs[i].len = segs[i].len;
+    }
+
+    return hal_uart_write_gather(port_segs, n, port_tx_done, &tm);
+}
+
+static uint32_t port_now_us(void *ctx)
+{
+    return (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+static void port_link_stats(void *ctx, struct token_manager_stats *stats)
+{
+    uint32_t overruns, misses;
+
+    hal_uart_stats_get(&overruns, &misses);
+    stats->rx_overruns += overruns;
+    stats->buf_misses += misses;
+}
+
+/*
+ * Application layer API (design document, section 7.3). Only the newest
+ * reading matters, so it goes to a mailbox slot rather than the TX queue:
+ * a reading not yet sent is replaced, and none go stale behind a slow token.
+ */
+static int app_send_sensor_data(uint32_t sample)
+{
+#ifdef CONFIG_TOKEN_RING_CLOCK_SYNC
+    /* Stamped with the ring time, zero until it is known */
+    uint8_t value[sizeof(sample) + sizeof(uint32_t)];
+    uint32_t ring_us = 0;
+
+    (void)token_manager_ring_time(&tm, &ring_us, NULL);
+    sys_put_be32(ring_us, &value[sizeof(sample)]);
+#else
+    uint8_t value[sizeof(sample)];
+#endif
+
+    sys_put_be32(sample, value);
+
+    int ret = token_manager_mailbox_write(&tm, sensor_mbox, value, sizeof(value));
+#ifdef CONFIG_TOKEN_RING_MAC_INSERTION
+    /* No token will come by; the token manager thread sends it once woken */
+    hal_uart_wake();
+#endif
+
+    return ret;
+}
+
+static void app_receive_data(struct token_manager *mgr, uint8_t src, const uint8_t *data,
+                             size_t len, void *user_data)
+{
+#ifdef CONFIG_TOKEN_RING_CLOCK_SYNC
+    uint32_t ring_us;
+
+    /* Type, key, sample and its ring time: the age of the sample is the one-way latency */
+    if (len == 2 + 2 * sizeof(uint32_t) && data[0] == APP_MSG_SENSOR &&
+        sys_get_be32(&data[6]) != 0 && token_manager_ring_time(mgr, &ring_us, NULL) == 0) {
+        LOG_INF("Sensor sample from node %u, %u us old", src, ring_us - sys_get_be32(&data[6]));
+        return;
+    }
+#endif
+    LOG_INF("Data frame from node %u (%u bytes)", src, (unsigned int)len);
+}
+
+#ifdef CONFIG_TOKEN_RING_TOKEN_FAST_PASS
+/* UART RX hook: only runs while the token manager thread waits for input */
+static bool app_rx_fast(const uint8_t *data, size_t len, void *user_data)
+{
+    return token_manager_rx_fast(&tm, data, len);
+}
+#endif
+
+static void app_receive_diag(struct token_manager *mgr, uint8_t src, uint8_t kind,
+                             const uint8_t *payload, size_t len, void *user_data)
+{
+    struct tm_histogram_summary s;
+    struct token_manager_stats st;
+    enum tm_hist_id id;
+
+    switch (kind) {
+    case TM_DIAG_HIST_RESPONSE:
+        if (tm_diag_hist_decode(payload, len, &id, &s) == 0) {
+            LOG_INF("Node %u histogram %d: n=%u p50=%u p99=%u max=%u us", src, id, s.count,
+                    s.p50, s.p99, s.max);
+        }
         break;
-    case UART_TX_ABORTED:
-        LOG_ERR("TX aborted");
+    case TM_DIAG_STATS_RESPONSE:
+        if (tm_diag_stats_decode(payload, len, &st) == 0) {
+            LOG_INF("Node %u: tx=%u rx=%u fwd=%u crc=%u ovr=%u tmo=%u miss=%u txq_hw=%u", src,
+                    st.frames_tx, st.frames_rx, st.frames_fwd, st.crc_errors, st.rx_overruns,
+                    st.token_timeouts, st.buf_misses, st.tx_q_high_water);
+        }
         break;
     default:
-        LOG_DBG("Unhandled UART event: %d", evt->type);
         break;
     }
 }
 
+static void tm_thread_fn(void *p1, void *p2, void *p3)
+{
+    uint8_t buf[64];
+#if defined(CONFIG_TOKEN_RING_HIST_DUMP_INTERVAL_S) && CONFIG_TOKEN_RING_HIST_DUMP_INTERVAL_S > 0
+    int64_t next_dump = k_uptime_get() + CONFIG_TOKEN_RING_HIST_DUMP_INTERVAL_S * MSEC_PER_SEC;
+#endif
+
+    while (true) {
+#ifdef CONFIG_TOKEN_RING_MAC_TDMA
+        /* Wake for the next slot or sync frame, not just the next tick */
+        hal_uart_wait_rx(K_USEC(MIN(token_manager_next_due_us(&tm), TM_TICK_MS * USEC_PER_MSEC)));
+#else
+        hal_uart_wait_rx(K_MSEC(TM_TICK_MS));
+#endif
+
+        size_t len;
+        do {
+            len = sizeof(buf);
+            hal_uart_read(buf, &len);
+            token_manager_rx_bytes(&tm, buf, len);
+        } while (len == sizeof(buf));
+
+        token_manager_tick(&tm);
+
+#if defined(CONFIG_TOKEN_RING_HIST_DUMP_INTERVAL_S) && CONFIG_TOKEN_RING_HIST_DUMP_INTERVAL_S > 0
+        if (k_uptime_get() >= next_dump) {
+            token_manager_hist_dump(&tm);
+            next_dump += CONFIG_TOKEN_RING_HIST_DUMP_INTERVAL_S * MSEC_PER_SEC;
+        }
+#endif
+    }
+}
+
+static void app_thread_fn(void *p1, void *p2, void *p3)
+{
+    uint32_t sample = 0;
+
+    while (true) {
+        if (app_send_sensor_data(sample++) < 0) {
+            LOG_WRN("Sensor sample not sent");
+        }
+        k_sleep(K_MSEC(SENSOR_PERIOD_MS));
+    }
+}
+
+K_THREAD_DEFINE(tm_thread_id, TM_THREAD_STACK_SIZE, tm_thread_fn, NULL, NULL, NULL,
+                TM_THREAD_PRIORITY, 0, SYS_FOREVER_MS);
+K_THREAD_DEFINE(app_thread_id, APP_THREAD_STACK_SIZE, app_thread_fn, NULL, NULL, NULL,
+                APP_THREAD_PRIORITY, 0, SYS_FOREVER_MS);
+
 void main(void)
 {
-    const struct device *uart_dev = DEVICE_DT_GET(DT_NODELABEL(uart0));
-    if (!device_is_ready(uart_dev)) {
-        LOG_ERR("UART device not ready");
+    if (hal_uart_init() < 0) {
         return;
     }
 
-    uart_callback_set(uart_dev, uart_cb, NULL);
+    const struct token_manager_config cfg = {
+        .node_id = CONFIG_TOKEN_RING_NODE_ID,
+        .start_node = (CONFIG_TOKEN_RING_NODE_ID == 0),
+#ifdef CONFIG_TOKEN_RING_TOKENS
+        .tokens = CONFIG_TOKEN_RING_TOKENS,
+        .start_tokens = CONFIG_TOKEN_RING_START_TOKENS,
+#endif
+#ifdef CONFIG_TOKEN_RING_MAC_SLOTTED
+        .mac = TM_MAC_SLOTTED,
+        .slots = CONFIG_TOKEN_RING_SLOTS,
+#elif defined(CONFIG_TOKEN_RING_MAC_INSERTION)
+        .mac = TM_MAC_INSERTION,
+#elif defined(CONFIG_TOKEN_RING_MAC_TDMA)
+        .mac = TM_MAC_TDMA,
+        .tdma_cycle_us = CONFIG_TOKEN_RING_TDMA_CYCLE_US,
+        .tdma_offset_us = CONFIG_TOKEN_RING_TDMA_OFFSET_US,
+#endif
+        .clock_sync = IS_ENABLED(CONFIG_TOKEN_RING_CLOCK_SYNC),
+        .fast_pass = IS_ENABLED(CONFIG_TOKEN_RING_TOKEN_FAST_PASS),
+#ifdef CONFIG_TOKEN_RING_TELEMETRY_NODES
+        .telemetry_nodes = CONFIG_TOKEN_RING_TELEMETRY_NODES,
+#endif
+        .port = {
+            .tx = port_tx,
+            .tx_gather = port_tx_gather,
+            .now_us = port_now_us,
+            .link_stats = port_link_stats,
+        },
+        .rx_cb = app_receive_data,
+        .diag_cb = app_receive_diag,
+    };
 
-    /* Enable RX with the first buffer */
-    int ret = uart_rx_enable(uart_dev, rx_buf[0], sizeof(rx_buf[0]), SYS_FOREVER_MS);
+    int ret = token_manager_init(&tm, &cfg);
     if (ret < 0) {
-        LOG_ERR("Failed to enable UART RX: %d", ret);
+        LOG_ERR("Token manager init failed: %d", ret);
         return;
     }
 
-    const char *msg = "Hello UART!\n";
-    for (const char *p = msg; *p != '\0'; p++) {
-        uart_poll_out(uart_dev, *p);
+    /* One sensor per node, so a single key */
+    sensor_mbox = token_manager_mailbox_open(&tm, APP_MSG_SENSOR, 0);
+    if (sensor_mbox < 0) {
+        LOG_ERR("Sensor mailbox open failed: %d", sensor_mbox);
+        return;
     }
 
-    LOG_INF("Message sent over UART");
-}
\ No newline at end of file
+#ifdef CONFIG_TOKEN_RING_TOKEN_FAST_PASS
+    hal_uart_set_rx_hook(app_rx_fast, NULL);
+#endif
+    k_thread_start(tm_thread_id);
+    k_thread_start(app_thread_id);
+
+    LOG_INF("Node %u up", CONFIG_TOKEN_RING_NODE_ID);
+}
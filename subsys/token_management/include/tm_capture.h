@@ -0,0 +1,61 @@
+/*
+ * Promiscuous frame capture (sniffer mode).
+ *
+ * TM_CAPTURE() records every frame handed to token_manager_process_frame(),
+ * valid or not, as a pcap record. Records are appended to a ring buffer
+ * under a short spinlock and the capture thread writes them straight out
+ * of that buffer to the backend (an RTT up-channel, or a host file on
+ * native_sim), so the token manager never waits on I/O.
+ *
+ * The stream is a classic pcap file (microsecond timestamps, little endian)
+ * with link type LINKTYPE_USER0. Records are stamped from the 64-bit
+ * uptime rather than the token manager's 32-bit clock, so long captures
+ * stay in order instead of wrapping every 71 minutes. Each packet is a
+ * 4-byte pseudo header followed by the raw frame, CRC included:
+ *
+ *   u8 version | u8 capturing node | u8 flags | u8 0 | frame bytes
+ *
+ * scripts/tm_ring.lua is a Wireshark dissector for this format.
+ */
+
+#ifndef TM_CAPTURE_H_
+#define TM_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/sys/util.h>
+
+#define TM_CAPTURE_VERSION      1
+#define TM_CAPTURE_LINKTYPE     147 /* LINKTYPE_USER0 */
+#define TM_CAPTURE_PSEUDO_HDR   4
+
+#define TM_CAPTURE_F_BAD_CRC    BIT(0)
+#define TM_CAPTURE_F_MALFORMED  BIT(1)
+
+#ifdef CONFIG_TOKEN_MANAGER_CAPTURE
+
+/* decode_ret is the result of tm_frame_decode() for this frame */
+void tm_capture_frame(uint8_t node, const uint8_t *frame, size_t len, int decode_ret);
+
+/* Write the pcap file header into buf. Returns its length. */
+size_t tm_capture_file_header(uint8_t *buf, size_t size);
+
+/*
+ * Copy pending records into buf. Returns the number of bytes written.
+ * Must not be called concurrently with itself or the capture thread.
+ */
+size_t tm_capture_drain(uint8_t *buf, size_t size);
+
+/* Records dropped because the capture buffer was full */
+uint32_t tm_capture_dropped(void);
+
+#define TM_CAPTURE(node, frame, len, ret) tm_capture_frame((node), (frame), (len), (ret))
+
+#else
+
+#define TM_CAPTURE(node, frame, len, ret) do { } while (0)
+
+#endif /* CONFIG_TOKEN_MANAGER_CAPTURE */
+
+#endif /* TM_CAPTURE_H_ */
@@ -0,0 +1,146 @@
+/*
+ * Ring diagnostics.
+ *
+ * Diagnostic frames (0xCC, see token_frame.h) let any node query a peer
+ * without a debug probe on that board. A request is queued with
+ * token_manager_diag_request() and goes out ahead of data frames on the
+ * requester's next token hold. The addressed node answers on its own hold,
+ * which follows in the same rotation, and the response is handed to the
+ * requester's diag_cb. Multi-byte payload fields are big endian.
+ */
+
+#ifndef TM_DIAG_H_
+#define TM_DIAG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "token_manager.h"
+
+#define TM_DIAG_RESPONSE_FLAG 0x80
+
+enum tm_diag_kind {
+    /* Request: u8 histogram ID */
+    TM_DIAG_HIST_REQUEST = 0x01,
+    /* Response: u8 histogram ID | struct tm_histogram_summary as 8 x u32 */
+    TM_DIAG_HIST_RESPONSE = TM_DIAG_HIST_REQUEST | TM_DIAG_RESPONSE_FLAG,
+    /* Request: empty */
+    TM_DIAG_STATS_REQUEST = 0x02,
+    /* Response: struct token_manager_stats as 8 x u32 */
+    TM_DIAG_STATS_RESPONSE = TM_DIAG_STATS_REQUEST | TM_DIAG_RESPONSE_FLAG,
+    /*
+     * Request: collect snapshot (below) with no records, addressed to the
+     * requester itself. Every node it passes appends its record, so it
+     * returns after one rotation and is handed to the requester's diag_cb
+     * as TM_DIAG_COLLECT_RESPONSE. Never sent as such.
+     */
+    TM_DIAG_COLLECT = 0x03,
+    TM_DIAG_COLLECT_RESPONSE = TM_DIAG_COLLECT | TM_DIAG_RESPONSE_FLAG,
+};
+
+/*
+ * Columns of a collect snapshot. Counters are the low 16 bits of the
+ * token_manager_stats fields of the same name, so deltas between two
+ * snapshots hold across wraparound.
+ */
+enum tm_collect_col {
+    /* u8 enum token_manager_state */
+    TM_COLLECT_STATE,
+    /* u16 counters */
+    TM_COLLECT_FRAMES_TX,
+    TM_COLLECT_FRAMES_RX,
+    TM_COLLECT_FRAMES_FWD,
+    TM_COLLECT_CRC_ERRORS,
+    TM_COLLECT_RX_OVERRUNS,
+    TM_COLLECT_TOKEN_TIMEOUTS,
+    TM_COLLECT_BUF_MISSES,
+    TM_COLLECT_COLS,
+};
+
+#define TM_COLLECT_ALL ((uint8_t)((1U << TM_COLLECT_COLS) - 1))
+
+/*
+ * A collect snapshot is u8 column mask | u8 record count n, then one array
+ * per column: n node IDs in ring order from the requester, followed by n
+ * values of each column in the mask, lowest bit first. Every array starts
+ * at an offset given by the mask and n alone, so a gateway reads a column
+ * straight out of the payload with no per-record decoding. A node whose
+ * record would not fit in TM_MAX_PAYLOAD is left out; with all columns a
+ * snapshot holds 15 nodes.
+ */
+#define TM_DIAG_COLLECT_HDR_LEN 2
+
+/* Decoded view into a collect snapshot; it points into the payload */
+struct tm_diag_collect {
+    uint8_t columns;
+    uint8_t count;
+    const uint8_t *node_ids;
+    /* Start of each column's array, NULL if the column was not collected */
+    const uint8_t *cols[TM_COLLECT_COLS];
+};
+
+#define TM_DIAG_HIST_RESPONSE_LEN  (1 + sizeof(struct tm_histogram_summary))
+#define TM_DIAG_STATS_RESPONSE_LEN (sizeof(struct token_manager_stats))
+
+/*
+ * Queue a diagnostic request for node dst. Safe to call from any thread.
+ * Returns -ENOMSG if the diagnostic queue is full.
+ */
+int token_manager_diag_request(struct token_manager *tm, uint8_t dst, uint8_t kind,
+                               const uint8_t *arg, size_t len);
+
+static inline int token_manager_hist_request(struct token_manager *tm, uint8_t dst,
+                                             enum tm_hist_id id)
+{
+    uint8_t arg = id;
+
+    return token_manager_diag_request(tm, dst, TM_DIAG_HIST_REQUEST, &arg, sizeof(arg));
+}
+
+static inline int token_manager_stats_request(struct token_manager *tm, uint8_t dst)
+{
+    return token_manager_diag_request(tm, dst, TM_DIAG_STATS_REQUEST, NULL, 0);
+}
+
+/*
+ * Snapshot the given columns (a mask of BIT(enum tm_collect_col)) of every
+ * node in one rotation. The result arrives at diag_cb.
+ */
+static inline int token_manager_collect_request(struct token_manager *tm, uint8_t columns)
+{
+    uint8_t arg[TM_DIAG_COLLECT_HDR_LEN] = {columns, 0};
+
+    return token_manager_diag_request(tm, tm->cfg.node_id, TM_DIAG_COLLECT, arg, sizeof(arg));
+}
+
+/* Parse the payload of a TM_DIAG_HIST_RESPONSE */
+int tm_diag_hist_decode(const uint8_t *payload, size_t len, enum tm_hist_id *id,
+                        struct tm_histogram_summary *summary);
+
+/* Parse the payload of a TM_DIAG_STATS_RESPONSE */
+int tm_diag_stats_decode(const uint8_t *payload, size_t len, struct token_manager_stats *stats);
+
+/* Bytes one node adds to a collect snapshot of the given columns */
+size_t tm_diag_collect_record_len(uint8_t columns);
+
+/* Parse the payload of a TM_DIAG_COLLECT_RESPONSE */
+int tm_diag_collect_decode(const uint8_t *payload, size_t len, struct tm_diag_collect *snap);
+
+/* Value of a collected column for the i-th node of the snapshot */
+uint16_t tm_diag_collect_get(const struct tm_diag_collect *snap, enum tm_collect_col col,
+                             size_t i);
+
+/* Log a summary and the non-empty buckets of every histogram of this node */
+void token_manager_hist_dump(struct token_manager *tm);
+
+/* Internal: answer a request addressed to this node */
+void tm_diag_handle_request(struct token_manager *tm, uint8_t src, uint8_t kind,
+                            const uint8_t *payload, size_t len);
+
+/*
+ * Internal: append this node's record to a collect snapshot of len bytes,
+ * in place; payload has room for TM_MAX_PAYLOAD. Returns the new length.
+ */
+size_t tm_diag_collect_append(struct token_manager *tm, uint8_t *payload, size_t len);
+
+#endif /* TM_DIAG_H_ */
@@ -0,0 +1,56 @@
+/*
+ * Fixed-memory log-linear latency histogram (HDR style).
+ *
+ * Values below 2^SUB_BITS are counted exactly; above that, every power of
+ * two is split into 2^SUB_BITS equal sub-buckets, so any recorded value is
+ * known to within 1/2^SUB_BITS of itself (6.25% with the default of 4).
+ * Values at or above 2^MAX_BITS land in the last bucket. Recording is O(1)
+ * and the histogram never allocates.
+ */
+
+#ifndef TM_HISTOGRAM_H_
+#define TM_HISTOGRAM_H_
+
+#include <stdint.h>
+
+/* Compact summary, also the payload of a histogram diagnostic response */
+struct tm_histogram_summary {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t mean;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t p999;
+};
+
+#ifdef CONFIG_TOKEN_MANAGER_HISTOGRAMS
+
+#define TM_HIST_SUB_BITS   CONFIG_TOKEN_MANAGER_HISTOGRAM_SUB_BUCKET_BITS
+#define TM_HIST_MAX_BITS   CONFIG_TOKEN_MANAGER_HISTOGRAM_MAX_VALUE_BITS
+#define TM_HIST_SUB_COUNT  (1U << TM_HIST_SUB_BITS)
+#define TM_HIST_BUCKETS    ((TM_HIST_MAX_BITS - TM_HIST_SUB_BITS + 1) * TM_HIST_SUB_COUNT)
+
+struct tm_histogram {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[TM_HIST_BUCKETS];
+};
+
+void tm_hist_reset(struct tm_histogram *h);
+void tm_hist_record(struct tm_histogram *h, uint32_t value);
+
+/* Upper bound of the bucket holding the given quantile, in 1/1000 units */
+uint32_t tm_hist_percentile(const struct tm_histogram *h, uint32_t permille);
+
+void tm_hist_summarize(const struct tm_histogram *h, struct tm_histogram_summary *s);
+
+/* Value range [low, high] covered by a bucket */
+void tm_hist_bucket_range(uint32_t idx, uint32_t *low, uint32_t *high);
+
+#endif /* CONFIG_TOKEN_MANAGER_HISTOGRAMS */
+
+#endif /* TM_HISTOGRAM_H_ */
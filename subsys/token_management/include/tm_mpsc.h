@@ -0,0 +1,69 @@
+/*
+ * Lock-free multi-producer, single-consumer queue.
+ *
+ * Producers push intrusive nodes with a CAS on the head; the consumer takes
+ * everything pushed so far with one atomic exchange and gets it back in push
+ * order. Because the consumer never pops single nodes the usual ABA problem
+ * of CAS-based stacks cannot arise. Nodes are owned by the caller; a node
+ * must not be pushed again until the consumer has taken it.
+ */
+
+#ifndef TM_MPSC_H_
+#define TM_MPSC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <zephyr/sys/atomic.h>
+
+struct tm_mpsc_node {
+    struct tm_mpsc_node *next;
+};
+
+struct tm_mpsc {
+    atomic_ptr_t head;
+};
+
+static inline void tm_mpsc_init(struct tm_mpsc *q)
+{
+    atomic_ptr_set(&q->head, NULL);
+}
+
+/* Safe from any thread or ISR */
+static inline void tm_mpsc_push(struct tm_mpsc *q, struct tm_mpsc_node *node)
+{
+    atomic_ptr_val_t old;
+
+    do {
+        old = atomic_ptr_get(&q->head);
+        node->next = old;
+    } while (!atomic_ptr_cas(&q->head, old, node));
+}
+
+/*
+ * Take every pushed node at once, oldest first, as a NULL-terminated list.
+ * Consumer only.
+ */
+static inline struct tm_mpsc_node *tm_mpsc_take_all(struct tm_mpsc *q)
+{
+    struct tm_mpsc_node *node = atomic_ptr_set(&q->head, NULL);
+    struct tm_mpsc_node *fifo = NULL;
+
+    /* The stack holds the newest node first: reverse it */
+    while (node != NULL) {
+        struct tm_mpsc_node *next = node->next;
+
+        node->next = fifo;
+        fifo = node;
+        node = next;
+    }
+
+    return fifo;
+}
+
+static inline bool tm_mpsc_is_empty(struct tm_mpsc *q)
+{
+    return atomic_ptr_get(&q->head) == NULL;
+}
+
+#endif /* TM_MPSC_H_ */
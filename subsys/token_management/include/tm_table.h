@@ -0,0 +1,68 @@
+/*
+ * Ring-replicated table.
+ *
+ * Every node owns one record of a small shared table. A node publishes its
+ * record through a mailbox slot, so the newest version goes out on its next
+ * token hold; the frame then travels the whole ring before its origin strips
+ * it, and every other node snoops it on the way past into its own copy.
+ * Replicas therefore catch up within one rotation of the owner's hold, at a
+ * cost of one frame per update instead of a request and a response per pair
+ * of nodes.
+ *
+ * Records are only sent when published. A node that joins late sees a peer's
+ * record once that peer publishes again.
+ */
+
+#ifndef TM_TABLE_H_
+#define TM_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+#include "token_manager.h"
+
+struct tm_table_entry {
+    /* Odd while the entry is being updated; zero until a record arrives */
+    atomic_t seq;
+    uint8_t len;
+    uint8_t rec[CONFIG_TOKEN_MANAGER_TABLE_RECORD_SIZE];
+    /* Port clock when the record was written or received */
+    uint32_t updated_us;
+};
+
+struct tm_table {
+    struct token_manager *tm;
+    uint8_t type;
+    int mbox;
+    int sub;
+    struct tm_table_entry entries[CONFIG_TOKEN_MANAGER_TABLE_NODES];
+};
+
+/*
+ * Attach a table to a node. type is the message type, the first payload
+ * byte, that carries this table's records; each table needs its own. Uses
+ * one mailbox slot and one receive subscription. Call from the token
+ * manager context.
+ */
+int tm_table_init(struct tm_table *t, struct token_manager *tm, uint8_t type);
+
+/*
+ * Replace this node's record. The local copy is updated at once and peers'
+ * copies after the next token hold. Safe to call from any thread, one
+ * publisher at a time. Returns -EMSGSIZE if len exceeds
+ * CONFIG_TOKEN_MANAGER_TABLE_RECORD_SIZE.
+ */
+int tm_table_publish(struct tm_table *t, const void *rec, size_t len);
+
+/*
+ * Copy node's record into rec, without locking, and optionally the port
+ * clock of its last update. Safe from any thread. Returns the record
+ * length, -ENODATA if none has arrived yet, -ENOBUFS if size is too small,
+ * or -EBUSY if it kept changing during the copy.
+ */
+int tm_table_read(struct tm_table *t, uint8_t node, void *rec, size_t size,
+                  uint32_t *updated_us);
+
+#endif /* TM_TABLE_H_ */
@@ -0,0 +1,74 @@
+/*
+ * Hot-path binary tracing.
+ *
+ * TM_TRACE() records a cycle counter, an event ID and a 16-bit argument
+ * into a per-CPU ring buffer. Writers never block or take locks: a slot is
+ * reserved with an atomic increment and stamped with its sequence number
+ * once filled, so the reader can detect slots that are still being written
+ * or that were overwritten before it got to them. With
+ * CONFIG_TOKEN_MANAGER_TRACE disabled every trace point compiles away.
+ *
+ * A background thread drains the buffers and streams them to the selected
+ * backend (an RTT up-channel, or a host file on native_sim) as:
+ *
+ *   stream header: "TMTR" | u8 version | u8 record size | u16 0 | u32 cycles/s
+ *   block:         u8 0xB1 | u8 cpu | u16 count | u32 lost | count records
+ *   record:        u32 cycles | u16 arg | u8 event | u8 node
+ *
+ * All multi-byte fields are little endian. scripts/tm_trace_decode.py turns
+ * a captured stream back into a timeline.
+ */
+
+#ifndef TM_TRACE_H_
+#define TM_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TM_TRACE_VERSION     1
+#define TM_TRACE_BLOCK_MAGIC 0xB1
+#define TM_TRACE_NODE_HAL    0xFF
+
+enum tm_trace_event {
+    TM_TRACE_NONE,
+    TM_TRACE_STATE,             /* arg: new enum token_manager_state */
+    TM_TRACE_TOKEN_RX,          /* arg: token ID */
+    TM_TRACE_DATA_RX,           /* arg: source node << 8 | payload length */
+    TM_TRACE_FRAME_DROP,        /* arg: negated decode error */
+    TM_TRACE_TX,                /* arg: bytes handed to the port */
+    TM_TRACE_TOKEN_REGEN,       /* arg: new token ID */
+    TM_TRACE_UART_RX_RDY,       /* arg: bytes received */
+    TM_TRACE_UART_RX_BUF_REQ,
+    TM_TRACE_UART_RX_DISABLED,
+    TM_TRACE_UART_TX_DONE,      /* arg: bytes sent */
+    TM_TRACE_UART_TX_ABORTED,   /* arg: bytes sent */
+    TM_TRACE_UART_OTHER,        /* arg: enum uart_event_type */
+    TM_TRACE_UART_CB_EXIT,      /* arg: enum uart_event_type just handled */
+};
+
+struct tm_trace_record {
+    uint32_t cycles;
+    uint16_t arg;
+    uint8_t event;
+    uint8_t node;
+};
+
+#ifdef CONFIG_TOKEN_MANAGER_TRACE
+
+void tm_trace_emit(uint8_t node, uint8_t event, uint16_t arg);
+
+/*
+ * Copy pending records into buf as stream blocks. Returns the number of
+ * bytes written. Must not be called concurrently with itself.
+ */
+size_t tm_trace_drain(uint8_t *buf, size_t size);
+
+#define TM_TRACE(node, event, arg) tm_trace_emit((node), (event), (uint16_t)(arg))
+
+#else
+
+#define TM_TRACE(node, event, arg) do { } while (0)
+
+#endif /* CONFIG_TOKEN_MANAGER_TRACE */
+
+#endif /* TM_TRACE_H_ */
@@ -0,0 +1,314 @@
+/*
+ * Token-ring frame codec.
+ *
+ * Frame formats (design document, section 3.1):
+ *
+ *   Token frame: 0xAA | Token ID | CRC16 (big endian)
+ *   Data frame:  0xBB | Node ID  | Payload Length | Payload | CRC16
+ *
+ * A token may carry ring-wide aggregates, folded in by every node it passes
+ * (see token_manager_agg_set()). Each field is an operation, the result of
+ * the last full rotation and the accumulator of the current one, the
+ * values as big-endian signed 32-bit integers:
+ *
+ *   Aggregating token: 0xAB | Token ID | Field Count | (Op | Result | Acc)... | CRC16
+ *
+ * A data frame may instead be addressed to one node, which removes it from
+ * the ring (see token_manager_send_to()). The destination trails the
+ * payload so the payload starts where it does in a data frame:
+ *
+ *   Addressed frame: 0xBC | Node ID | Payload Length | Payload | Destination | CRC16
+ *
+ * Destinations tell the sources what they removed on a later token, which
+ * then carries a seen report per source and destination pair as well as
+ * any aggregation fields:
+ *
+ *   Reporting token: 0xAC | Token ID | Field Count | Report Count | Fields... |
+ *                    (Source | Destination | Frames)... | CRC16
+ *
+ * A token may also end in a telemetry trailer with a slot for each node ID
+ * below Node Count, where that node puts its last hold time and forwarding
+ * delay as big-endian 16-bit microseconds, or TM_TELEM_UNKNOWN:
+ *
+ *   Telemetry token: 0xAE | Token ID | Field Count | Report Count | Node Count | Fields... |
+ *                    Reports... | (Hold | Forward)... | CRC16
+ *
+ * Diagnostic frames carry ring management traffic (see tm_diag.h) and are
+ * addressed, unlike data frames:
+ *
+ *   Diag frame:  0xCC | Source | Destination | Kind | Payload Length | Payload | CRC16
+ *
+ * A process data frame is a data frame with a working counter, whose payload
+ * is a datagram shared by the whole ring rather than a message from its
+ * source. Nodes exchange their part of it as it passes (see token_manager.h)
+ * and add one to the counter. The start node, as the monitor, sets the
+ * TM_PDATA_MONITOR bit of the counter byte in frames going past it:
+ *
+ *   Process data: 0xDD | Source | Working Counter | Length | Datagram | CRC16
+ *
+ * In slotted mode (see token_manager_config.mac) the ring carries a fixed
+ * set of slots instead of tokens, all of the same size and padded to it.
+ * The control byte holds the slot number and the TM_SLOT_FULL and
+ * TM_SLOT_MONITOR bits; source, destination and length only mean
+ * something in a full slot:
+ *
+ *   Slot frame:  0xEE | Control | Source | Destination | Length | Payload | CRC16
+ *
+ * In TDMA mode the time master starts every cycle with a sync frame, which
+ * every node passes on. Origin is the master's clock when it sent the
+ * frame; each node adds the time the frame spent with it to Correction,
+ * and one to Hops, the links crossed on arrival. Hop Delay is the
+ * master's last measurement of one link, from a sync frame that came
+ * back, or TM_SYNC_HOP_UNKNOWN before it has one. Sequence counts the
+ * master's sync frames. Times are big-endian microseconds:
+ *
+ *   Sync frame:  0xAD | Hops | Sequence | Origin | Correction | Hop Delay (16 bits) | CRC16
+ *
+ * With clock sync in token mode a sync frame goes just ahead of token 0,
+ * and its times are those of the token's previous rotation, Sequence:
+ * Origin is when that token finished leaving the master, and Correction
+ * the time it spent with each node, from its arrival to the end of its
+ * departure. TM_SYNC_NO_CORRECTION there means a node missed it.
+ *
+ * The CRC is CRC-16/CCITT (seed 0xFFFF) over every byte preceding it.
+ */
+
+#ifndef TOKEN_FRAME_H_
+#define TOKEN_FRAME_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TM_TOKEN_DELIMITER 0xAA
+#define TM_AGG_DELIMITER   0xAB
+#define TM_SEEN_DELIMITER  0xAC
+#define TM_SYNC_DELIMITER  0xAD
+#define TM_TELEM_DELIMITER 0xAE
+#define TM_DATA_DELIMITER  0xBB
+#define TM_ADDR_DELIMITER  0xBC
+#define TM_DIAG_DELIMITER  0xCC
+#define TM_PDATA_DELIMITER 0xDD
+#define TM_SLOT_DELIMITER  0xEE
+
+#define TM_CRC_LEN         2
+#define TM_TOKEN_HDR_LEN   2
+#define TM_TOKEN_FRAME_LEN (TM_TOKEN_HDR_LEN + TM_CRC_LEN)
+#define TM_DATA_HDR_LEN    3
+#define TM_DIAG_HDR_LEN    5
+#define TM_PDATA_HDR_LEN   4
+#define TM_AGG_HDR_LEN     3
+#define TM_SLOT_HDR_LEN    5
+#define TM_AGG_FIELD_LEN   9
+#define TM_AGG_MAX_FIELDS  8
+#define TM_SEEN_HDR_LEN    4
+#define TM_SEEN_REPORT_LEN 3
+#define TM_SEEN_MAX        8
+#define TM_SYNC_HDR_LEN    13
+#define TM_TELEM_HDR_LEN   5
+#define TM_TELEM_SLOT_LEN  4
+#define TM_TELEM_MAX_NODES 32
+#define TM_SYNC_FRAME_LEN  (TM_SYNC_HDR_LEN + TM_CRC_LEN)
+#define TM_MAX_PAYLOAD     255
+#define TM_MAX_FRAME_LEN   (TM_DIAG_HDR_LEN + TM_MAX_PAYLOAD + TM_CRC_LEN)
+
+#define TM_DATA_FRAME_LEN(payload_len) (TM_DATA_HDR_LEN + (payload_len) + TM_CRC_LEN)
+#define TM_DIAG_FRAME_LEN(payload_len) (TM_DIAG_HDR_LEN + (payload_len) + TM_CRC_LEN)
+#define TM_PDATA_FRAME_LEN(len)        (TM_PDATA_HDR_LEN + (len) + TM_CRC_LEN)
+#define TM_AGG_FRAME_LEN(fields)       (TM_AGG_HDR_LEN + (fields) * TM_AGG_FIELD_LEN + TM_CRC_LEN)
+#define TM_ADDR_FRAME_LEN(payload_len) (TM_DATA_FRAME_LEN(payload_len) + 1)
+#define TM_SLOT_FRAME_LEN(size)        (TM_SLOT_HDR_LEN + (size) + TM_CRC_LEN)
+#define TM_SEEN_FRAME_LEN(fields, reports)                                                         \
+    (TM_SEEN_HDR_LEN + (fields) * TM_AGG_FIELD_LEN + (reports) * TM_SEEN_REPORT_LEN + TM_CRC_LEN)
+#define TM_TELEM_FRAME_LEN(fields, reports, nodes)                                                 \
+    (TM_SEEN_FRAME_LEN(fields, reports) + TM_TELEM_HDR_LEN - TM_SEEN_HDR_LEN +                     \
+     (nodes) * TM_TELEM_SLOT_LEN)
+
+/* Destination of a data frame that is not addressed; never a node ID */
+#define TM_BROADCAST 0xFF
+
+/* Slot control byte: carries a frame, has passed the monitor since it was filled, slot number */
+#define TM_SLOT_FULL     0x80
+#define TM_SLOT_MONITOR  0x40
+#define TM_SLOT_NUM_MASK 0x3F
+
+/* Process data counter byte: has passed the monitor, slots exchanged */
+#define TM_PDATA_MONITOR  0x80
+#define TM_PDATA_WKC_MASK 0x7F
+
+/* Correction of a sync frame that some node could not measure its delay for */
+#define TM_SYNC_NO_CORRECTION 0xFFFFFFFF
+/* Hop delay of a sync frame sent before the master has measured a link */
+#define TM_SYNC_HOP_UNKNOWN   0xFFFF
+
+/* Telemetry time a node has not measured, or not yet put in its slot */
+#define TM_TELEM_UNKNOWN      0xFFFF
+
+/* CRC of an empty buffer, for tm_frame_crc_update() */
+#define TM_CRC_INIT 0xFFFF
+
+enum tm_frame_type {
+    TM_FRAME_TOKEN,
+    TM_FRAME_DATA,
+    TM_FRAME_DIAG,
+    TM_FRAME_PDATA,
+    TM_FRAME_SLOT,
+    TM_FRAME_SYNC,
+};
+
+/* Aggregation operations; the identity is INT32_MAX for MIN, INT32_MIN for MAX, else 0 */
+enum tm_agg_op {
+    /* Wraps around on overflow */
+    TM_AGG_SUM,
+    TM_AGG_MIN,
+    TM_AGG_MAX,
+    /* Nodes contributing a value */
+    TM_AGG_COUNT,
+};
+
+/* Set in a field's operation once its result covers a full rotation */
+#define TM_AGG_RESULT_VALID 0x80
+
+struct tm_agg_field {
+    uint8_t op;
+    int32_t result;
+    int32_t acc;
+};
+
+/* Addressed frames from src that dst has removed since its last report */
+struct tm_seen_report {
+    uint8_t src;
+    uint8_t dst;
+    uint8_t frames;
+};
+
+/* A node's slot in a telemetry trailer, in microseconds */
+struct tm_telem_slot {
+    uint16_t hold_us;
+    uint16_t fwd_us;
+};
+
+/* Timing carried by a sync frame, in microseconds */
+struct tm_sync {
+    uint8_t hops;
+    uint8_t seq;
+    uint32_t origin_us;
+    uint32_t correction_us;
+    uint16_t hop_us;
+};
+
+/* Decoded view of a frame; payload points into the caller's buffer. */
+struct tm_frame {
+    enum tm_frame_type type;
+    uint8_t token_id;
+    /* Source node of data and diagnostic frames */
+    uint8_t node_id;
+    /* Destination of diagnostic and data frames, TM_BROADCAST if not addressed */
+    uint8_t dst;
+    uint8_t kind;
+    /* Working counter of process data frames */
+    uint8_t wkc;
+    /* Control byte of slot frames */
+    uint8_t ctrl;
+    /* Payload length (of a slot's contents), or the field count of an aggregating token */
+    uint8_t len;
+    const uint8_t *payload;
+    /* Seen reports of a reporting token, packed */
+    uint8_t n_seen;
+    const uint8_t *seen;
+    /* Telemetry slots of a telemetry token, packed */
+    uint8_t n_telem;
+    const uint8_t *telem;
+    struct tm_sync sync;
+};
+
+uint16_t tm_frame_crc(const uint8_t *buf, size_t len);
+/* Extend crc over len more bytes, for frames checked or built piecewise */
+uint16_t tm_frame_crc_update(uint16_t crc, const uint8_t *buf, size_t len);
+
+/* Encoders return the number of bytes written, or 0 if buf is too small. */
+size_t tm_frame_encode_token(uint8_t *buf, size_t size, uint8_t token_id);
+size_t tm_frame_encode_data(uint8_t *buf, size_t size, uint8_t node_id,
+                            const uint8_t *payload, size_t len);
+/*
+ * Fill in the header and CRC of a data frame whose payload has already been
+ * written at buf + TM_DATA_HDR_LEN. Returns the frame length.
+ */
+size_t tm_frame_finish_data(uint8_t *buf, uint8_t node_id, size_t len);
+/* As tm_frame_finish_data(), for a frame addressed to dst */
+size_t tm_frame_finish_addr(uint8_t *buf, uint8_t node_id, uint8_t dst, size_t len);
+size_t tm_frame_encode_diag(uint8_t *buf, size_t size, uint8_t src, uint8_t dst, uint8_t kind,
+                            const uint8_t *payload, size_t len);
+/* As tm_frame_finish_data(), for a diagnostic frame */
+size_t tm_frame_finish_diag(uint8_t *buf, uint8_t src, uint8_t dst, uint8_t kind, size_t len);
+/* A token carrying n aggregation fields packed by tm_frame_agg_field_put() */
+size_t tm_frame_encode_agg_token(uint8_t *buf, size_t size, uint8_t token_id,
+                                 const uint8_t *fields, size_t n);
+/* As tm_frame_encode_agg_token(), adding n_seen reports packed by tm_frame_seen_put() */
+size_t tm_frame_encode_seen_token(uint8_t *buf, size_t size, uint8_t token_id,
+                                  const uint8_t *fields, size_t n, const uint8_t *seen,
+                                  size_t n_seen);
+/* As tm_frame_encode_seen_token(), adding n_telem slots packed by tm_frame_telem_put() */
+size_t tm_frame_encode_telem_token(uint8_t *buf, size_t size, uint8_t token_id,
+                                   const uint8_t *fields, size_t n, const uint8_t *seen,
+                                   size_t n_seen, const uint8_t *telem, size_t n_telem);
+size_t tm_frame_encode_pdata(uint8_t *buf, size_t size, uint8_t src, uint8_t wkc,
+                             const uint8_t *datagram, size_t len);
+size_t tm_frame_encode_sync(uint8_t *buf, size_t size, const struct tm_sync *sync);
+/*
+ * Fill in the header, padding and CRC of a slot of size payload bytes
+ * whose first len bytes have been written at buf + TM_SLOT_HDR_LEN.
+ * Returns the frame length.
+ */
+size_t tm_frame_finish_slot(uint8_t *buf, uint8_t ctrl, uint8_t src, uint8_t dst, size_t len,
+                            size_t size);
+
+/* Unpack and pack field i of packed aggregation fields */
+void tm_frame_agg_field_get(const uint8_t *fields, size_t i, struct tm_agg_field *field);
+void tm_frame_agg_field_put(uint8_t *fields, size_t i, const struct tm_agg_field *field);
+/* Unpack and pack report i of packed seen reports */
+void tm_frame_seen_get(const uint8_t *seen, size_t i, struct tm_seen_report *report);
+void tm_frame_seen_put(uint8_t *seen, size_t i, const struct tm_seen_report *report);
+/* Unpack and pack slot i of packed telemetry slots */
+void tm_frame_telem_get(const uint8_t *telem, size_t i, struct tm_telem_slot *slot);
+void tm_frame_telem_put(uint8_t *telem, size_t i, const struct tm_telem_slot *slot);
+
+/*
+ * Validate and decode one complete frame.
+ * Returns 0, -EINVAL for a malformed frame or -EBADMSG on CRC mismatch.
+ */
+int tm_frame_decode(const uint8_t *buf, size_t len, struct tm_frame *frame);
+
+/*
+ * Byte-stream deframer. Bytes outside a frame are skipped until a start
+ * delimiter is seen; each complete frame is handed to the callback as-is
+ * (CRC not yet checked).
+ *
+ * Frames are assembled in buf, which the owner points at TM_MAX_FRAME_LEN
+ * bytes of storage. The callback may point buf at fresh storage to keep
+ * the frame it was just given.
+ *
+ * Slot frames are only recognised once slot_size is set to the ring's slot
+ * size, as their header does not give it.
+ *
+ * If cut_through is set to a start delimiter, feeding stops in front of
+ * any frame starting with it, so the owner can handle that frame byte by
+ * byte as it arrives. feed() returns the number of bytes consumed.
+ */
+typedef void (*tm_frame_cb_t)(const uint8_t *frame, size_t len, void *user_data);
+
+struct tm_frame_decoder {
+    uint8_t *buf;
+    size_t pos;
+    size_t need;
+    /* Start delimiter of frames left to the owner, zero for none */
+    uint8_t cut_through;
+    /* Payload bytes of a slot frame, zero outside slotted mode */
+    uint8_t slot_size;
+};
+
+void tm_frame_decoder_reset(struct tm_frame_decoder *dec);
+size_t tm_frame_decoder_feed(struct tm_frame_decoder *dec, const uint8_t *data, size_t len,
+                             tm_frame_cb_t cb, void *user_data);
+
+#endif /* TOKEN_FRAME_H_ */
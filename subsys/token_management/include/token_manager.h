@@ -1 +1,738 @@
-/* Token manager API - Placeholder */
+/*
+ * Token manager API.
+ *
+ * Implements the data link layer of the ring: token passing, data frame
+ * transmission and forwarding, and token-loss recovery. The token manager
+ * is transport agnostic; bytes go out through a port supplied by the caller
+ * (the UART HAL on hardware, a simulated link in tests), and received bytes
+ * are pushed in with token_manager_rx_bytes().
+ *
+ * Unless noted otherwise, functions must be called from a single context,
+ * normally the token manager thread.
+ */
+
+#ifndef TOKEN_MANAGER_H_
+#define TOKEN_MANAGER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+#include "token_frame.h"
+#include "tm_histogram.h"
+#include "tm_mpsc.h"
+
+enum token_manager_state {
+    TM_STATE_IDLE,
+    TM_STATE_TOKEN_RECEIVED,
+    TM_STATE_DATA_TRANSMISSION,
+    TM_STATE_TOKEN_FORWARDING,
+    TM_STATE_ERROR_RECOVERY,
+};
+
+/* Latency histograms kept by every node, in microseconds */
+enum tm_hist_id {
+    /* Interval between successive token arrivals */
+    TM_HIST_ROTATION,
+    /* Token arrival until the token is handed on */
+    TM_HIST_HOLD,
+    /* Data frame received until it is forwarded */
+    TM_HIST_HOP_DELAY,
+    /* Own data frame sent until it returns after a full ring trip */
+    TM_HIST_FRAME_LATENCY,
+    TM_HIST_COUNT,
+};
+
+/* Histograms the start node keeps for each node from token telemetry, in microseconds */
+enum tm_telem_id {
+    /* Token arrival until it was handed to the port */
+    TM_TELEM_HOLD,
+    /* Token handed to the port until the write carrying it was complete */
+    TM_TELEM_FORWARD,
+    TM_TELEM_COUNT,
+};
+
+#if defined(CONFIG_TOKEN_MANAGER_TELEMETRY_NODES) && CONFIG_TOKEN_MANAGER_TELEMETRY_NODES > 0
+#define TM_TELEM_HIST_NODES CONFIG_TOKEN_MANAGER_TELEMETRY_NODES
+#else
+#define TM_TELEM_HIST_NODES 0
+#endif
+
+#define TM_DIAG_MAX_PAYLOAD 64
+#define TM_TX_STAMPS        32
+/* Tokens that may circulate at once, see token_manager_config.tokens */
+#define TM_MAX_TOKENS       8
+/* Slots on the ring in slotted mode, see token_manager_config.slots */
+#define TM_MAX_SLOTS        (TM_SLOT_NUM_MASK + 1)
+
+/* Wildcard for token_manager_subscribe() */
+#define TM_SUB_ANY          (-1)
+/* Source nodes and message types covered by the subscription prefilter (one bit each) */
+#define TM_SUB_FILTER_BITS  32
+
+struct token_manager;
+
+/* Medium access, see token_manager_config.mac */
+enum token_manager_mac {
+    /* Nodes send while holding a token */
+    TM_MAC_TOKEN,
+    /* Nodes fill empty slots circulating on the ring */
+    TM_MAC_SLOTTED,
+    /* Nodes send whenever no upstream traffic is waiting behind them */
+    TM_MAC_INSERTION,
+    /* Nodes send in their own slot of a cycle timed by the master's sync frames */
+    TM_MAC_TDMA,
+};
+
+/*
+ * Traffic and error counters, one cache line per node. Exported to peers
+ * as a diagnostic response (see tm_diag.h).
+ */
+struct token_manager_stats {
+    /* Own data frames put on the ring */
+    uint32_t frames_tx;
+    /* Data frames from other nodes handed to the application */
+    uint32_t frames_rx;
+    /* Data and diagnostic frames passed on to the next node */
+    uint32_t frames_fwd;
+    uint32_t crc_errors;
+    /* Link level, reported by the port */
+    uint32_t rx_overruns;
+    /* Token regenerations (slot set recreations) by this node after a timeout */
+    uint32_t token_timeouts;
+    /* Chunks the transport, or frames the RX pool, had no buffer for */
+    uint32_t buf_misses;
+    uint32_t tx_q_high_water;
+} __aligned(32);
+
+/* A piece of a frame handed to the port by reference */
+struct token_manager_tx_seg {
+    const uint8_t *buf;
+    size_t len;
+};
+
+/* Segments of one hold: queued diagnostic frames, data frames, a sync frame, the token */
+#define TM_TX_SEGS (CONFIG_TOKEN_MANAGER_MAX_FRAMES_PER_HOLD + 3)
+
+struct token_manager_port {
+    /*
+     * Queue bytes for the next node: one or more whole frames, back to back.
+     * buf must be consumed or copied before returning.
+     */
+    int (*tx)(void *ctx, const uint8_t *buf, size_t len);
+    /*
+     * Optional: queue segments for the next node without copying them.
+     * Segments and their data stay untouched until the port calls
+     * token_manager_tx_done(); if this returns an error it must not call
+     * it. Used for token holds, so data frames go out from their TX slots.
+     */
+    int (*tx_gather)(void *ctx, const struct token_manager_tx_seg *segs, size_t n);
+    /* Free-running microsecond clock */
+    uint32_t (*now_us)(void *ctx);
+    /* Optional: add link-level counts to the counters block */
+    void (*link_stats)(void *ctx, struct token_manager_stats *stats);
+    void *ctx;
+};
+
+/* Called for every valid data frame originated by another node and not addressed elsewhere */
+typedef void (*token_manager_rx_cb_t)(struct token_manager *tm, uint8_t src,
+                                      const uint8_t *payload, size_t len, void *user_data);
+
+/*
+ * A received data frame lent to subscribers. payload points into an RX pool
+ * buffer that stays valid until every subscriber handed the frame has
+ * called token_manager_rx_release(). The view may be copied.
+ */
+struct token_manager_rx_view {
+    uint8_t src;
+    uint8_t len;
+    const uint8_t *payload;
+    /* Pool buffer, internal */
+    uint8_t buf;
+};
+
+typedef void (*token_manager_sub_cb_t)(struct token_manager *tm,
+                                       const struct token_manager_rx_view *view,
+                                       void *user_data);
+
+/* Called for every diagnostic response addressed to this node */
+typedef void (*token_manager_diag_cb_t)(struct token_manager *tm, uint8_t src, uint8_t kind,
+                                        const uint8_t *payload, size_t len, void *user_data);
+
+/* Called when a token reports that node dst took frames more of this node's addressed frames */
+typedef void (*token_manager_seen_cb_t)(struct token_manager *tm, uint8_t dst, uint8_t frames,
+                                        void *user_data);
+
+/*
+ * Exchanges this node's slot of a passing process data frame in place: slot
+ * holds the bytes put there upstream and is overwritten with this node's.
+ */
+typedef void (*token_manager_pd_slot_cb_t)(struct token_manager *tm, uint8_t *slot, size_t len,
+                                           void *user_data);
+
+/* Called when a process data frame sent by this node has been round the ring */
+typedef void (*token_manager_pd_done_cb_t)(struct token_manager *tm, const uint8_t *datagram,
+                                           size_t len, uint8_t wkc, void *user_data);
+
+/*
+ * Called at the end of a passing process data frame whose slot went to
+ * pd_cb, with whether the frame's CRC was good
+ */
+typedef void (*token_manager_pd_end_cb_t)(struct token_manager *tm, bool valid,
+                                          void *user_data);
+
+struct token_manager_config {
+    uint8_t node_id;
+    /* The start node injects the first token and numbers circulations */
+    bool start_node;
+    /*
+     * Optional: tokens circulating at once, a power of two up to
+     * TM_MAX_TOKENS, alike on every node; zero means one. Token IDs keep
+     * their index in the low bits. A data frame is sent on the token whose
+     * index is its message type, the first payload byte, modulo tokens, so
+     * each token grants a disjoint set of types. Diagnostic and process
+     * data frames and aggregation fields go with token 0.
+     */
+    uint8_t tokens;
+    /* Further tokens this node injects and numbers, one bit per index; start_node is bit 0 */
+    uint8_t start_tokens;
+    /*
+     * Optional: medium access (enum token_manager_mac), alike on every
+     * node. In slotted mode the start node, as the monitor, puts a set of
+     * empty slots of CONFIG_TOKEN_MANAGER_SLOT_SIZE payload bytes on the
+     * ring instead of a token, and they circulate for good. A node puts an
+     * updated mailbox value, or else its oldest queued data frame, into
+     * each empty slot that passes. A full slot is emptied by the
+     * destination of an addressed frame (see token_manager_send_to()), or
+     * by the source once a broadcast frame is back; a source passes a slot
+     * it emptied on empty, so the next node gets a turn. The monitor
+     * empties full slots that come round a second time, whose source has
+     * gone. Only data frames are carried: diagnostics, process data and
+     * aggregation need a token.
+     *
+     * In register-insertion mode there is no token. Frames arriving from
+     * upstream while the node is sending wait in an insertion buffer of
+     * CONFIG_TOKEN_MANAGER_INSERTION_BUFFER_SIZE bytes, and a frame that
+     * does not fit is dropped; otherwise they pass straight on. Once a
+     * transmission ends the node drains the buffer, or, if nothing came
+     * in meanwhile, sends an updated mailbox value or its oldest queued
+     * data frame. Upstream traffic therefore goes first and a node sends
+     * into the gaps in it. Frames are stripped as with a token, by their
+     * source or destination. Needs port.tx_gather, whose completion marks
+     * the end of each transmission, and only data frames are carried;
+     * seen reports, like diagnostics, process data and aggregation, need
+     * a token. The mode is built in with CONFIG_TOKEN_MANAGER_MAC_INSERTION.
+     *
+     * In TDMA mode the start node is the time master. It starts a cycle
+     * of tdma_cycle_us every cycle of its own clock with a sync frame,
+     * which each node passes on after adding its own delay to it; the
+     * master measures the delay of a link from the sync frame's return
+     * and puts it in the next one. From these a node sets its estimate of
+     * the master's clock, and follows the drift between the two. Each
+     * node sends once every cycle, tdma_offset_us into it, as it would
+     * when holding the token, and not at all until synchronised.
+     * Diagnostic and data frames are carried; process data, aggregation
+     * and seen reports need a token. The schedule must leave every node
+     * time for max_frames_per_hold frames and their trip round the ring.
+     */
+    uint8_t mac;
+    /* Slots the monitor creates in slotted mode, up to TM_MAX_SLOTS; zero means one */
+    uint8_t slots;
+    /* TDMA mode: cycle length and this node's slot in it, in the master's microseconds */
+    uint32_t tdma_cycle_us;
+    uint32_t tdma_offset_us;
+    /*
+     * Optional, token mode: a plain token ending the bytes handed to
+     * token_manager_rx_bytes() takes the fast pass (see
+     * token_manager_rx_fast()) once the bytes ahead of it are handled. On
+     * a loaded ring the token mostly comes in the same RX chunk as the
+     * frames before it, which the RX callback cannot pass on.
+     */
+    bool fast_pass;
+    /*
+     * Optional, token mode: keep a ring time, the start node's clock as
+     * every node estimates it (see token_manager_ring_time()), alike on
+     * every node. A sync frame goes just ahead of token 0 with the times
+     * of its previous rotation: when it finished leaving the start node,
+     * and how long each node kept it, from its arrival to the end of its
+     * departure as the port's tx_gather completion marks it. The start
+     * node measures the delay of a link from the sync frame's return, and
+     * puts it in the next one. Needs port.tx_gather, and port.now_us safe
+     * from the context token_manager_tx_done() is called in.
+     */
+    bool clock_sync;
+    struct token_manager_port port;
+    token_manager_rx_cb_t rx_cb;
+    token_manager_diag_cb_t diag_cb;
+    /* Optional: seen reports for addressed frames, see token_manager_send_to() */
+    token_manager_seen_cb_t seen_cb;
+    /* Optional: this node's slot in process data frames, see token_manager_pdata_send() */
+    uint8_t pd_offset;
+    uint8_t pd_len;
+    token_manager_pd_slot_cb_t pd_cb;
+    token_manager_pd_done_cb_t pd_done_cb;
+    token_manager_pd_end_cb_t pd_end_cb;
+    /* Optional: process data sources are below this node ID; zero for any */
+    uint8_t pd_nodes;
+    /*
+     * Optional: aggregation fields of tokens created by this node, with
+     * the operation (enum tm_agg_op) of each. Only the node creating the
+     * token, normally the start node, uses these; set them alike on every
+     * node so a regenerated token carries the same fields.
+     */
+    uint8_t agg_fields;
+    uint8_t agg_ops[TM_AGG_MAX_FIELDS];
+    /*
+     * Optional, token mode: slots in the telemetry trailer of token 0 when
+     * created by this node, one for each node ID below this, at most
+     * TM_TELEM_MAX_NODES. Each node the token passes puts its hold time
+     * and forwarding delay (enum tm_telem_id) in its slot. The forwarding
+     * delay is known only once the token has gone, so it is that of the
+     * node's previous pass, and only with port.tx_gather and port.now_us
+     * safe from the context token_manager_tx_done() is called in. When
+     * the token is back, the start node records every slot in its
+     * telemetry histograms (see token_manager_telemetry_get()). Set it
+     * alike on every node, as agg_fields.
+     */
+    uint8_t telemetry_nodes;
+    void *user_data;
+    /* Zero selects the Kconfig defaults */
+    uint32_t token_timeout_us;
+    uint32_t regen_stagger_us;
+    uint8_t max_frames_per_hold;
+};
+
+/* A data frame being written by the application or waiting for the token */
+struct token_manager_tx_slot {
+    /* Room for the destination of an addressed frame */
+    uint8_t frame[TM_ADDR_FRAME_LEN(TM_MAX_PAYLOAD)];
+    /* Payload bytes granted by token_manager_reserve() */
+    uint8_t reserved;
+    struct tm_mpsc_node node;
+};
+
+/* Latest-value-wins send slot, see token_manager_mailbox_open() */
+struct token_manager_mbox {
+    uint8_t frame[TM_DATA_FRAME_LEN(CONFIG_TOKEN_MANAGER_MAILBOX_MAX_PAYLOAD)];
+    /* Odd while a writer is updating frame */
+    atomic_t seq;
+};
+
+struct token_manager_sub {
+    int16_t src;
+    int16_t type;
+    token_manager_sub_cb_t cb;
+    void *user_data;
+};
+
+struct token_manager_rx_buf {
+    uint8_t frame[TM_MAX_FRAME_LEN];
+    /* Subscribers still holding this buffer */
+    atomic_t refs;
+};
+
+/* A process data frame being passed on as it arrives */
+struct token_manager_pd_rx {
+    /* Bytes of the frame received so far, zero between frames */
+    uint16_t pos;
+    uint8_t hdr[TM_PDATA_HDR_LEN];
+    /* Back at its origin, so assembled whole in the decoder's buffer instead */
+    bool own;
+    /* Back at the monitor, so assembled there likewise and dropped */
+    bool strip;
+    /* This node exchanges its slot in this frame */
+    bool slot_used;
+    bool tx_failed;
+    /* CRC over the bytes as received, and as passed on */
+    uint16_t crc_in;
+    uint16_t crc_out;
+    uint8_t crc[TM_CRC_LEN];
+    /* Incoming slot bytes, held back until the slot is complete */
+    uint8_t slot[CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN];
+#ifdef CONFIG_TOKEN_MANAGER_CAPTURE
+    /* The frame as received, recorded once it has passed */
+    uint8_t cap[TM_PDATA_FRAME_LEN(UINT8_MAX)];
+#endif
+};
+
+struct token_manager_diag_msg {
+    uint8_t dst;
+    uint8_t kind;
+    uint8_t len;
+    uint8_t payload[TM_DIAG_MAX_PAYLOAD];
+};
+
+/*
+ * What a node knows of one circulating token, for rotation and loss
+ * detection; in slotted mode tokens[0] follows slot 0 instead
+ */
+struct token_manager_token {
+    /* As last passed on */
+    uint8_t id;
+    bool seen;
+    uint32_t last_us;
+};
+
+struct token_manager {
+    struct token_manager_config cfg;
+    enum token_manager_state state;
+    /* Token of the current hold */
+    uint8_t token_id;
+    struct token_manager_token tokens[TM_MAX_TOKENS];
+    /* Circulations of token 0, or slot 0 */
+    uint32_t rotation_us;
+    uint32_t rotations;
+    /* Slotted mode: when any slot last passed, for the monitor's loss detection */
+    uint32_t slot_rx_us;
+#ifdef CONFIG_TOKEN_MANAGER_MAC_INSERTION
+    /*
+     * Insertion mode: upstream frames held while we send, in ins_buf[ins_fill]
+     * while the other buffer may be draining
+     */
+    uint8_t ins_buf[2][CONFIG_TOKEN_MANAGER_INSERTION_BUFFER_SIZE];
+    uint16_t ins_len[2];
+    uint8_t ins_frames[2];
+    uint8_t ins_fill;
+    /* Arrival of the oldest frame in the filling buffer */
+    uint32_t ins_rx_us;
+#endif
+    /*
+     * TDMA mode or clock sync: the master's clock read sync_offset_us
+     * ahead of ours at the last sync frame, and gains drift_ppb on ours
+     * since. Updated between two increments of clock_seq, so readers in
+     * other threads can tell they raced an update.
+     */
+    bool synced;
+    uint32_t sync_rx_us;
+    int32_t sync_offset_us;
+    int32_t drift_ppb;
+    atomic_t clock_seq;
+    /* Next slot of ours, by the master's clock */
+    uint32_t tdma_next_us;
+    /* Master: next cycle start, and the link delay last measured */
+    uint32_t sync_next_us;
+    uint16_t sync_hop_us;
+    /*
+     * Clock sync and telemetry: arrival and departure of token 0 on the
+     * rotations numbered clk_rx_seq and clk_tx_seq; the departure is
+     * stamped by token_manager_tx_done() while clk_tx says it is pending.
+     * A TDMA master numbers its sync frames with clk_tx_seq.
+     */
+    bool clk_rx_valid;
+    uint8_t clk_rx_seq;
+    uint32_t clk_rx_us;
+    uint8_t clk_tx_seq;
+    atomic_t clk_tx;
+    uint32_t clk_tx_us;
+    /* Stamp the departure of the token about to be written */
+    bool clk_armed;
+    /* When the token of the stamped departure was handed to the port */
+    uint32_t clk_hand_us;
+    /* Sync frame received ahead of token 0, to go on ahead of it again */
+    bool clk_held;
+    struct tm_sync clk_sync;
+    struct tm_frame_decoder dec;
+    struct token_manager_pd_rx pd_rx;
+    /* Aggregation fields of the last token, folded into and passed on */
+    uint8_t agg[TM_AGG_MAX_FIELDS * TM_AGG_FIELD_LEN];
+    uint8_t agg_n;
+    /* Local values (bit set in agg_set) and ring-wide results (agg_valid), any thread */
+    atomic_t agg_value[TM_AGG_MAX_FIELDS];
+    atomic_t agg_set;
+    atomic_t agg_result[TM_AGG_MAX_FIELDS];
+    atomic_t agg_valid;
+    /* Seen reports of the last token, passed on, and those of this node not yet sent */
+    uint8_t seen[TM_SEEN_MAX * TM_SEEN_REPORT_LEN];
+    uint8_t seen_n;
+    struct tm_seen_report seen_pending[TM_SEEN_MAX];
+    uint8_t seen_pending_n;
+    /* Telemetry slots of the last token 0, stamped and passed on */
+    uint8_t telem[TM_TELEM_MAX_NODES * TM_TELEM_SLOT_LEN];
+    uint8_t telem_n;
+    /* Datagram for the next hold, see token_manager_pdata_send() */
+    uint8_t pd_tx[CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN];
+    uint8_t pd_tx_len;
+    bool pd_tx_pending;
+    /* RX pool: the decoder assembles into rx_cur, lent buffers return to rx_free */
+    struct token_manager_rx_buf rx_pool[CONFIG_TOKEN_MANAGER_RX_POOL_BUFFERS];
+    atomic_t rx_free;
+    uint8_t rx_cur;
+    struct token_manager_sub subs[CONFIG_TOKEN_MANAGER_RX_SUBSCRIPTIONS];
+    uint32_t subs_used;
+    /*
+     * Some subscription may match a frame only if bit (src % 32) of
+     * rx_src_filter or bit (type % 32) of rx_type_filter is set
+     */
+    uint32_t rx_src_filter;
+    uint32_t rx_type_filter;
+    struct token_manager_tx_slot tx_slots[CONFIG_TOKEN_MANAGER_TX_QUEUE_DEPTH];
+    /* Slots free for reserve() */
+    ATOMIC_DEFINE(tx_free, CONFIG_TOKEN_MANAGER_TX_QUEUE_DEPTH);
+    /* Committed slots, pushed lock-free by any thread */
+    struct tm_mpsc tx_q;
+    /* Slots taken from tx_q but not yet sent, oldest first; token manager only */
+    struct tm_mpsc_node *tx_pending;
+    struct tm_mpsc_node *tx_pending_tail;
+    uint32_t tx_pending_count;
+    struct token_manager_mbox mbox[CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS];
+    uint32_t mbox_used;
+    /* Slots written since they were last sent */
+    atomic_t mbox_dirty;
+    /* Where the next hold starts scanning, so no slot is starved */
+    uint8_t mbox_next;
+    struct k_msgq diag_q;
+    char __aligned(4) diag_q_buf[CONFIG_TOKEN_MANAGER_DIAG_QUEUE_DEPTH *
+                                 sizeof(struct token_manager_diag_msg)];
+    uint8_t tx_frame[TM_MAX_FRAME_LEN];
+    /* How the current hold reaches the port (copied, gathered or direct) */
+    uint8_t hold_mode;
+    /* Part of the current hold has already been handed to the port */
+    bool hold_flushed;
+#if CONFIG_TOKEN_MANAGER_TX_BATCH_SIZE > 0
+    /* Frames of the current hold copied for a single port write */
+    uint8_t tx_batch[CONFIG_TOKEN_MANAGER_TX_BATCH_SIZE];
+#endif
+    uint16_t tx_batch_len;
+    /* Own data frames in the hold's write, counted as sent once it is accepted */
+    uint16_t tx_batch_data;
+    /* Scatter-gather hold, and the slots the port still reads from */
+    struct token_manager_tx_seg tx_segs[TM_TX_SEGS];
+    uint8_t tx_n_segs;
+    uint8_t tx_token[TM_TELEM_FRAME_LEN(TM_AGG_MAX_FIELDS, TM_SEEN_MAX, TM_TELEM_MAX_NODES)];
+    /* Clock sync frame sent in place just ahead of token 0 */
+    uint8_t tx_clk[TM_SYNC_FRAME_LEN];
+    /* Plain token passed on by token_manager_rx_fast(); ID and CRC patched per use */
+    uint8_t tx_fast[TM_TOKEN_FRAME_LEN];
+    /* Tokens passed on that way */
+    uint32_t fast_passes;
+    struct tm_mpsc_node *tx_inflight;
+    atomic_t tx_gather_busy;
+    struct token_manager_stats stats;
+#ifdef CONFIG_TOKEN_MANAGER_HISTOGRAMS
+    struct tm_histogram hist[TM_HIST_COUNT];
+#if TM_TELEM_HIST_NODES > 0
+    /* Start node: every node's times from the telemetry of token 0 */
+    struct tm_histogram telem_hist[TM_TELEM_HIST_NODES][TM_TELEM_COUNT];
+#endif
+    uint32_t hold_start_us;
+    /* Send times of this hold's data frames, matched as they come back */
+    uint32_t tx_stamp_us[TM_TX_STAMPS];
+    uint8_t tx_sent;
+    uint8_t tx_returned;
+#endif
+};
+
+/*
+ * Initialise a node. If cfg->start_node is set the first token is sent
+ * immediately, starting token rotation, and likewise the tokens in
+ * cfg->start_tokens. Returns -EINVAL for a bad configuration.
+ */
+int token_manager_init(struct token_manager *tm, const struct token_manager_config *cfg);
+
+/* Feed raw bytes received from the previous node */
+void token_manager_rx_bytes(struct token_manager *tm, const uint8_t *data, size_t len);
+
+/*
+ * Fast pass for a node with nothing to send. If data is exactly one plain
+ * token (no aggregation fields, seen reports or telemetry) with a good CRC,
+ * or exactly the rest of one whose first bytes came in earlier chunks, and
+ * the hold it grants would send nothing and add nothing to it, the token
+ * is passed on at once from a prebuilt frame with only its ID and CRC
+ * filled in, without decoding it or running the state machine, and true
+ * is returned. Otherwise nothing is done, and data must go to
+ * token_manager_rx_bytes() as usual.
+ *
+ * Only the token MAC passes tokens this way. Safe from interrupt context,
+ * e.g. the UART RX callback, as long as no other token manager call that
+ * is not safe from any thread can run meanwhile (typically while the
+ * token manager thread waits for input with all received bytes handled).
+ * A chunk with other bytes ahead of the token must go to the thread, as
+ * the frames they end are passed on first; with cfg->fast_pass set,
+ * token_manager_rx_bytes() then passes the token on this way after them.
+ */
+bool token_manager_rx_fast(struct token_manager *tm, const uint8_t *data, size_t len);
+
+/* Handle one complete frame. Returns 0 or a negative frame decode error. */
+int token_manager_process_frame(struct token_manager *tm, const uint8_t *frame, size_t len);
+
+/*
+ * Queue a payload to be sent on the next token hold. Safe to call from any
+ * thread. Returns -ENOMSG if the TX queue is full.
+ */
+int token_manager_send_data_frame(struct token_manager *tm, const uint8_t *payload, size_t len);
+
+/*
+ * Zero-copy send, in two phases. token_manager_reserve() hands out a
+ * pointer to len payload bytes inside a TX frame slot; the caller writes
+ * its data there and passes the same pointer to token_manager_commit(),
+ * which fills in the header and CRC and queues the frame for the next hold.
+ * The committed length may be shorter than the reservation.
+ * token_manager_abort() returns an uncommitted slot unused. Safe to call
+ * from any thread; each reservation must be committed or aborted once.
+ *
+ * reserve() returns -EMSGSIZE if len exceeds TM_MAX_PAYLOAD, or in slotted
+ * mode CONFIG_TOKEN_MANAGER_SLOT_SIZE, and -ENOMEM if every slot is in use.
+ */
+int token_manager_reserve(struct token_manager *tm, size_t len, uint8_t **payload);
+int token_manager_commit(struct token_manager *tm, uint8_t *payload, size_t len);
+int token_manager_abort(struct token_manager *tm, uint8_t *payload);
+
+/*
+ * Destination stripping. A frame sent with token_manager_send_to(), or
+ * committed with token_manager_commit_to(), is addressed to node dst: the
+ * nodes in between pass it on without delivering it, and dst delivers it
+ * and removes it from the ring instead of forwarding it. The links from
+ * dst back round to the source stay free, so frames to nearby nodes leave
+ * most of the ring for other traffic, which several tokens (see
+ * token_manager_config.tokens) can then use at the same time.
+ *
+ * A destination counts what it removes from each source and adds the
+ * counts to the next token it passes on, up to TM_SEEN_MAX reports at a
+ * time; the source takes its reports off the token and hands them to
+ * seen_cb. An addressed frame that comes back to its source was not taken
+ * and is stripped there as usual.
+ *
+ * As token_manager_send_data_frame() and token_manager_commit(), with the
+ * same errors; both also return -EINVAL if dst is this node. TM_BROADCAST
+ * sends an ordinary data frame.
+ */
+int token_manager_send_to(struct token_manager *tm, uint8_t dst, const uint8_t *payload,
+                          size_t len);
+int token_manager_commit_to(struct token_manager *tm, uint8_t *payload, size_t len, uint8_t dst);
+
+/*
+ * Latest-value-wins send path for periodic data. token_manager_mailbox_open()
+ * returns a handle for the stream of frames whose payload starts with type
+ * and key, reusing the slot if that pair is already open; call it from the
+ * token manager context. token_manager_mailbox_write() replaces the slot's
+ * value, without locking, and the newest value goes out on the next token
+ * hold. Values written in between are never sent. Safe to call from any
+ * thread, with at most one writer per slot at a time.
+ *
+ * open() returns -ENOMEM if every slot is taken; write() returns -EINVAL
+ * for a bad handle and -EMSGSIZE if the type and key plus len bytes exceed
+ * CONFIG_TOKEN_MANAGER_MAILBOX_MAX_PAYLOAD.
+ */
+int token_manager_mailbox_open(struct token_manager *tm, uint8_t type, uint8_t key);
+int token_manager_mailbox_write(struct token_manager *tm, int handle, const uint8_t *value,
+                                size_t len);
+
+/*
+ * Process data exchange: the whole ring reads and writes a shared datagram
+ * in one pass of a single frame, instead of every node sending a frame of
+ * its own. token_manager_pdata_send() puts a datagram of len bytes on the
+ * ring with the next token hold. Every node configured with a slot, pd_len
+ * bytes at pd_offset into the datagram, has pd_cb called with the slot as
+ * the frame goes by (the sender's own slot first) and adds one to the
+ * working counter. Other nodes pass the frame on chunk by chunk as it is
+ * received, holding back only their own slot until it is complete, and
+ * carry the CRC over the new contents. The incoming CRC is only checked at
+ * the end of the frame, so pd_cb sees unchecked bytes: they only count as
+ * inputs once pd_end_cb reports the frame valid. A frame found bad is
+ * passed on with a bad CRC, and every node downstream finds it bad too.
+ * When the frame is back, pd_done_cb gets the datagram and the working
+ * counter, the number of slots exchanged, and may send the next one.
+ *
+ * A node only starts passing a frame on once its header is in, and takes
+ * a header with a source not below pd_nodes (if set), a working counter
+ * above it or a datagram longer than CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN
+ * for line noise. The start node marks the frames going past it and drops
+ * any that comes round again marked, so a frame whose source was lost or
+ * corrupted is gone after at most two rotations.
+ *
+ * Returns -EMSGSIZE if len exceeds CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN and
+ * -EBUSY if a datagram is still waiting for the token. Call from the token
+ * manager context.
+ */
+int token_manager_pdata_send(struct token_manager *tm, const uint8_t *datagram, size_t len);
+
+/*
+ * Ring-wide aggregation carried by the token. Each field of an aggregating
+ * token (see agg_fields in the config) accumulates one value per node as
+ * the token goes round, with the node folding in the value last given to
+ * token_manager_agg_set() when the token passes. Each time the token
+ * returns to the start node, the accumulator becomes the field's result,
+ * which every node picks up on the next pass. A result is therefore at
+ * most two rotations old, and costs a few bytes on the token instead of a
+ * frame per node.
+ *
+ * set() and clear() start and stop this node's contribution to field;
+ * get() copies out the latest result. All three are safe from any thread
+ * and return -EINVAL for a field beyond TM_AGG_MAX_FIELDS; get() returns
+ * -ENODATA until a result has been seen.
+ */
+int token_manager_agg_set(struct token_manager *tm, uint8_t field, int32_t value);
+int token_manager_agg_clear(struct token_manager *tm, uint8_t field);
+int token_manager_agg_get(struct token_manager *tm, uint8_t field, int32_t *value);
+
+/*
+ * Called by a port with tx_gather once every segment of the last gather
+ * write has been sent. Safe from interrupt context. In insertion mode the
+ * insertion buffer, or else the node's next frame, goes out on the next
+ * token_manager_tick() or received frame, so call tick soon after.
+ */
+void token_manager_tx_done(struct token_manager *tm);
+
+/*
+ * Ring time: this node's estimate of the time master's clock, the start
+ * node's, in TDMA mode or with clock sync, and of its drift against ours
+ * in parts per billion (positive if the master runs fast). drift_ppb may
+ * be NULL. Safe from any thread; a few reads and a multiply. Returns
+ * -ENODATA if not synchronised or neither is in use.
+ */
+int token_manager_ring_time(struct token_manager *tm, uint32_t *ring_us, int32_t *drift_ppb);
+
+/*
+ * TDMA mode: microseconds until token_manager_tick() has a slot or a sync
+ * frame to send, so the caller can sleep until then rather than for a
+ * fixed tick period. UINT32_MAX if nothing is scheduled, as in other
+ * modes or before synchronising. Call from the token manager context.
+ */
+uint32_t token_manager_next_due_us(struct token_manager *tm);
+
+/*
+ * Periodic housekeeping: detects the loss of any token and regenerates it;
+ * in slotted mode the monitor recreates the slots if none is passing. In
+ * insertion mode it sends the next queued frame if the line allows, so
+ * call it as well once frames are queued on an idle ring. In TDMA mode it
+ * sends this node's slot and the master's sync frames when due, and a node
+ * hearing no sync frame for the token timeout stops sending until it
+ * synchronises again.
+ */
+void token_manager_tick(struct token_manager *tm);
+
+/*
+ * Zero-copy receive. Registers cb for data frames from node src whose first
+ * payload byte (the message type) equals type; either may be TM_SUB_ANY.
+ * The callback runs in the token manager context and receives a view
+ * into the RX pool, which it must hand back with token_manager_rx_release(),
+ * from any thread, once done. Frames that no subscription can match are
+ * forwarded without touching the pool. Returns a subscription handle, or
+ * -ENOMEM if the table is full. Call from the token manager context.
+ */
+int token_manager_subscribe(struct token_manager *tm, int src, int type,
+                            token_manager_sub_cb_t cb, void *user_data);
+int token_manager_unsubscribe(struct token_manager *tm, int handle);
+void token_manager_rx_release(struct token_manager *tm, const struct token_manager_rx_view *view);
+
+/* Snapshot of this node's counters, including the port's link counters */
+void token_manager_stats_get(struct token_manager *tm, struct token_manager_stats *stats);
+
+/*
+ * Summary of the start node's telemetry histogram id for node (see
+ * telemetry_nodes in the config), from every rotation of token 0 so far.
+ * Call from the token manager context. Returns -ENOTSUP without
+ * CONFIG_TOKEN_MANAGER_TELEMETRY_NODES and -EINVAL for a node or id
+ * beyond it.
+ */
+int token_manager_telemetry_get(struct token_manager *tm, uint8_t node, enum tm_telem_id id,
+                                struct tm_histogram_summary *summary);
+
+static inline enum token_manager_state token_manager_state_get(const struct token_manager *tm)
+{
+    return tm->state;
+}
+
+#endif /* TOKEN_MANAGER_H_ */
@@ -0,0 +1,169 @@
+#include <errno.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include "tm_capture.h"
+#include "token_frame.h"
+
+#if defined(CONFIG_TOKEN_MANAGER_CAPTURE_BACKEND_RTT)
+#include <SEGGER_RTT.h>
+#elif defined(CONFIG_TOKEN_MANAGER_CAPTURE_BACKEND_FILE)
+#include "tm_trace_native.h"
+#endif
+
+LOG_MODULE_REGISTER(tm_capture, CONFIG_TOKEN_MANAGER_LOG_LEVEL);
+
+#define PCAP_MAGIC       0xA1B2C3D4
+#define PCAP_FILE_HDR    24
+#define PCAP_RECORD_HDR  16
+#define PCAP_SNAPLEN     (TM_CAPTURE_PSEUDO_HDR + TM_MAX_FRAME_LEN)
+
+#define CAPTURE_HDR      (PCAP_RECORD_HDR + TM_CAPTURE_PSEUDO_HDR)
+
+RING_BUF_DECLARE(capture_ring, CONFIG_TOKEN_MANAGER_CAPTURE_BUFFER_SIZE);
+static struct k_spinlock capture_lock;
+static atomic_t capture_dropped;
+
+void tm_capture_frame(uint8_t node, const uint8_t *frame, size_t len, int decode_ret)
+{
+    uint64_t ts_us = k_ticks_to_us_floor64(k_uptime_ticks());
+    uint8_t hdr[CAPTURE_HDR];
+    uint32_t caplen = TM_CAPTURE_PSEUDO_HDR + len;
+    uint8_t flags = 0;
+
+    if (decode_ret == -EBADMSG) {
+        flags |= TM_CAPTURE_F_BAD_CRC;
+    } else if (decode_ret < 0) {
+        flags |= TM_CAPTURE_F_MALFORMED;
+    }
+
+    sys_put_le32((uint32_t)(ts_us / USEC_PER_SEC), &hdr[0]);
+    sys_put_le32(ts_us % USEC_PER_SEC, &hdr[4]);
+    sys_put_le32(caplen, &hdr[8]);
+    sys_put_le32(caplen, &hdr[12]);
+    hdr[16] = TM_CAPTURE_VERSION;
+    hdr[17] = node;
+    hdr[18] = flags;
+    hdr[19] = 0;
+
+    /* Records go in whole or not at all so the stream stays parseable */
+    k_spinlock_key_t key = k_spin_lock(&capture_lock);
+
+    if (ring_buf_space_get(&capture_ring) < sizeof(hdr) + len) {
+        k_spin_unlock(&capture_lock, key);
+        atomic_inc(&capture_dropped);
+        return;
+    }
+    ring_buf_put(&capture_ring, hdr, sizeof(hdr));
+    ring_buf_put(&capture_ring, frame, len);
+
+    k_spin_unlock(&capture_lock, key);
+}
+
+size_t tm_capture_file_header(uint8_t *buf, size_t size)
+{
+    if (size < PCAP_FILE_HDR) {
+        return 0;
+    }
+
+    sys_put_le32(PCAP_MAGIC, &buf[0]);
+    sys_put_le16(2, &buf[4]);
+    sys_put_le16(4, &buf[6]);
+    /* Time zone offset and accuracy */
+    sys_put_le32(0, &buf[8]);
+    sys_put_le32(0, &buf[12]);
+    sys_put_le32(PCAP_SNAPLEN, &buf[16]);
+    sys_put_le32(TM_CAPTURE_LINKTYPE, &buf[20]);
+
+    return PCAP_FILE_HDR;
+}
+
+size_t tm_capture_drain(uint8_t *buf, size_t size)
+{
+    return ring_buf_get(&capture_ring, buf, size);
+}
+
+uint32_t tm_capture_dropped(void)
+{
+    return (uint32_t)atomic_get(&capture_dropped);
+}
+
+#if defined(CONFIG_TOKEN_MANAGER_CAPTURE_BACKEND_RTT)
+
+static uint8_t rtt_up_buf[CONFIG_TOKEN_MANAGER_CAPTURE_RTT_BUFFER_SIZE];
+
+static int capture_backend_init(void)
+{
+    int ret = SEGGER_RTT_ConfigUpBuffer(CONFIG_TOKEN_MANAGER_CAPTURE_RTT_CHANNEL, "tm_capture",
+                                        rtt_up_buf, sizeof(rtt_up_buf),
+                                        SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+
+    return ret < 0 ? -EIO : 0;
+}
+
+static void capture_backend_write(const uint8_t *data, size_t len)
+{
+    SEGGER_RTT_Write(CONFIG_TOKEN_MANAGER_CAPTURE_RTT_CHANNEL, data, len);
+}
+
+#elif defined(CONFIG_TOKEN_MANAGER_CAPTURE_BACKEND_FILE)
+
+static int capture_fd = -1;
+
+static int capture_backend_init(void)
+{
+    capture_fd = tm_trace_native_open(CONFIG_TOKEN_MANAGER_CAPTURE_FILE);
+
+    return capture_fd < 0 ? -EIO : 0;
+}
+
+static void capture_backend_write(const uint8_t *data, size_t len)
+{
+    tm_trace_native_write(capture_fd, data, len);
+}
+
+#endif
+
+#if !defined(CONFIG_TOKEN_MANAGER_CAPTURE_BACKEND_NONE)
+
+static void capture_thread_fn(void *p1, void *p2, void *p3)
+{
+    uint8_t hdr[PCAP_FILE_HDR];
+    uint32_t reported = 0;
+
+    if (capture_backend_init() < 0) {
+        LOG_ERR("Capture backend init failed");
+        return;
+    }
+
+    capture_backend_write(hdr, tm_capture_file_header(hdr, sizeof(hdr)));
+
+    while (true) {
+        uint8_t *data;
+        uint32_t len;
+
+        /* Write the batch straight out of the ring, one contiguous run at a time */
+        while ((len = ring_buf_get_claim(&capture_ring, &data,
+                                         CONFIG_TOKEN_MANAGER_CAPTURE_BUFFER_SIZE)) > 0) {
+            capture_backend_write(data, len);
+            ring_buf_get_finish(&capture_ring, len);
+        }
+
+        uint32_t dropped = tm_capture_dropped();
+        if (dropped != reported) {
+            LOG_WRN("Capture buffer full, %u records dropped", dropped - reported);
+            reported = dropped;
+        }
+
+        k_sleep(K_MSEC(CONFIG_TOKEN_MANAGER_CAPTURE_FLUSH_MS));
+    }
+}
+
+K_THREAD_DEFINE(tm_capture_thread, 1024, capture_thread_fn, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+#endif /* !CONFIG_TOKEN_MANAGER_CAPTURE_BACKEND_NONE */
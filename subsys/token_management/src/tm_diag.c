@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "tm_diag.h"
+
+LOG_MODULE_DECLARE(token_manager, CONFIG_TOKEN_MANAGER_LOG_LEVEL);
+
+#define SUMMARY_WORDS (sizeof(struct tm_histogram_summary) / sizeof(uint32_t))
+#define STATS_WORDS   (sizeof(struct token_manager_stats) / sizeof(uint32_t))
+
+BUILD_ASSERT(TM_DIAG_HIST_RESPONSE_LEN <= TM_DIAG_MAX_PAYLOAD);
+BUILD_ASSERT(TM_DIAG_STATS_RESPONSE_LEN <= TM_DIAG_MAX_PAYLOAD);
+
+static const uint8_t collect_widths[TM_COLLECT_COLS] = {
+    [TM_COLLECT_STATE] = 1,
+    [TM_COLLECT_FRAMES_TX] = 2,
+    [TM_COLLECT_FRAMES_RX] = 2,
+    [TM_COLLECT_FRAMES_FWD] = 2,
+    [TM_COLLECT_CRC_ERRORS] = 2,
+    [TM_COLLECT_RX_OVERRUNS] = 2,
+    [TM_COLLECT_TOKEN_TIMEOUTS] = 2,
+    [TM_COLLECT_BUF_MISSES] = 2,
+};
+
+static const char *const hist_names[TM_HIST_COUNT] = {
+    [TM_HIST_ROTATION] = "rotation",
+    [TM_HIST_HOLD] = "hold",
+    [TM_HIST_HOP_DELAY] = "hop",
+    [TM_HIST_FRAME_LATENCY] = "e2e",
+};
+
+static int diag_queue(struct token_manager *tm, uint8_t dst, uint8_t kind,
+                      const uint8_t *payload, size_t len)
+{
+    struct token_manager_diag_msg msg;
+
+    if (len > TM_DIAG_MAX_PAYLOAD) {
+        return -EMSGSIZE;
+    }
+
+    msg.dst = dst;
+    msg.kind = kind;
+    msg.len = (uint8_t)len;
+    if (len > 0) {
+        memcpy(msg.payload, payload, len);
+    }
+
+    return k_msgq_put(&tm->diag_q, &msg, K_NO_WAIT);
+}
+
+int token_manager_diag_request(struct token_manager *tm, uint8_t dst, uint8_t kind,
+                               const uint8_t *arg, size_t len)
+{
+    if (kind & TM_DIAG_RESPONSE_FLAG) {
+        return -EINVAL;
+    }
+
+    return diag_queue(tm, dst, kind, arg, len);
+}
+
+#ifdef CONFIG_TOKEN_MANAGER_HISTOGRAMS
+static void diag_hist_respond(struct token_manager *tm, uint8_t src, const uint8_t *payload,
+                              size_t len)
+{
+    uint8_t rsp[TM_DIAG_HIST_RESPONSE_LEN];
+    struct tm_histogram_summary s;
+    const uint32_t *words = (const uint32_t *)&s;
+
+    if (len < 1 || payload[0] >= TM_HIST_COUNT) {
+        LOG_DBG("Bad histogram request from node %u", src);
+        return;
+    }
+
+    tm_hist_summarize(&tm->hist[payload[0]], &s);
+
+    rsp[0] = payload[0];
+    for (size_t i = 0; i < SUMMARY_WORDS; i++) {
+        sys_put_be32(words[i], &rsp[1 + i * sizeof(uint32_t)]);
+    }
+
+    if (diag_queue(tm, src, TM_DIAG_HIST_RESPONSE, rsp, sizeof(rsp)) != 0) {
+        LOG_WRN("Diag queue full, dropped response to node %u", src);
+    }
+}
+#endif
+
+static void diag_stats_respond(struct token_manager *tm, uint8_t src)
+{
+    uint8_t rsp[TM_DIAG_STATS_RESPONSE_LEN];
+    struct token_manager_stats stats;
+    const uint32_t *words = (const uint32_t *)&stats;
+
+    token_manager_stats_get(tm, &stats);
+
+    for (size_t i = 0; i < STATS_WORDS; i++) {
+        sys_put_be32(words[i], &rsp[i * sizeof(uint32_t)]);
+    }
+
+    if (diag_queue(tm, src, TM_DIAG_STATS_RESPONSE, rsp, sizeof(rsp)) != 0) {
+        LOG_WRN("Diag queue full, dropped response to node %u", src);
+    }
+}
+
+void tm_diag_handle_request(struct token_manager *tm, uint8_t src, uint8_t kind,
+                            const uint8_t *payload, size_t len)
+{
+    switch (kind) {
+#ifdef CONFIG_TOKEN_MANAGER_HISTOGRAMS
+    case TM_DIAG_HIST_REQUEST:
+        diag_hist_respond(tm, src, payload, len);
+        break;
+#endif
+    case TM_DIAG_STATS_REQUEST:
+        diag_stats_respond(tm, src);
+        break;
+    default:
+        LOG_DBG("Unsupported diag request 0x%02x from node %u", kind, src);
+        break;
+    }
+}
+
+int tm_diag_hist_decode(const uint8_t *payload, size_t len, enum tm_hist_id *id,
+                        struct tm_histogram_summary *summary)
+{
+    uint32_t *words = (uint32_t *)summary;
+
+    if (len != TM_DIAG_HIST_RESPONSE_LEN || payload[0] >= TM_HIST_COUNT) {
+        return -EINVAL;
+    }
+
+    *id = payload[0];
+    for (size_t i = 0; i < SUMMARY_WORDS; i++) {
+        words[i] = sys_get_be32(&payload[1 + i * sizeof(uint32_t)]);
+    }
+
+    return 0;
+}
+
+int tm_diag_stats_decode(const uint8_t *payload, size_t len, struct token_manager_stats *stats)
+{
+    uint32_t *words = (uint32_t *)stats;
+
+    if (len != TM_DIAG_STATS_RESPONSE_LEN) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < STATS_WORDS; i++) {
+        words[i] = sys_get_be32(&payload[i * sizeof(uint32_t)]);
+    }
+
+    return 0;
+}
+
+static inline size_t collect_width(uint8_t columns, int col)
+{
+    return (columns & BIT(col)) ? collect_widths[col] : 0;
+}
+
+size_t tm_diag_collect_record_len(uint8_t columns)
+{
+    /* Node ID */
+    size_t len = 1;
+
+    for (int col = 0; col < TM_COLLECT_COLS; col++) {
+        len += collect_width(columns, col);
+    }
+
+    return len;
+}
+
+static uint16_t collect_value(const struct token_manager *tm,
+                              const struct token_manager_stats *stats, int col)
+{
+    switch (col) {
+    case TM_COLLECT_STATE:
+        return tm->state;
+    case TM_COLLECT_FRAMES_TX:
+        return (uint16_t)stats->frames_tx;
+    case TM_COLLECT_FRAMES_RX:
+        return (uint16_t)stats->frames_rx;
+    case TM_COLLECT_FRAMES_FWD:
+        return (uint16_t)stats->frames_fwd;
+    case TM_COLLECT_CRC_ERRORS:
+        return (uint16_t)stats->crc_errors;
+    case TM_COLLECT_RX_OVERRUNS:
+        return (uint16_t)stats->rx_overruns;
+    case TM_COLLECT_TOKEN_TIMEOUTS:
+        return (uint16_t)stats->token_timeouts;
+    default:
+        return (uint16_t)stats->buf_misses;
+    }
+}
+
+size_t tm_diag_collect_append(struct token_manager *tm, uint8_t *payload, size_t len)
+{
+    struct token_manager_stats stats;
+    uint8_t columns, n;
+    size_t rec, prefix;
+
+    if (len < TM_DIAG_COLLECT_HDR_LEN) {
+        return len;
+    }
+
+    columns = payload[0];
+    n = payload[1];
+    rec = tm_diag_collect_record_len(columns);
+    if (len != TM_DIAG_COLLECT_HDR_LEN + n * rec || len + rec > TM_MAX_PAYLOAD) {
+        LOG_DBG("Collect snapshot full or malformed, %u records", n);
+        return len;
+    }
+
+    token_manager_stats_get(tm, &stats);
+
+    /*
+     * Each array grows by one entry. Move the last one first: its new start
+     * lies past the old end of every array in front of it.
+     */
+    prefix = rec;
+    for (int col = TM_COLLECT_COLS - 1; col >= 0; col--) {
+        size_t width = collect_width(columns, col);
+        uint8_t *dst;
+
+        if (width == 0) {
+            continue;
+        }
+
+        prefix -= width;
+        dst = &payload[TM_DIAG_COLLECT_HDR_LEN + (n + 1) * prefix];
+        memmove(dst, &payload[TM_DIAG_COLLECT_HDR_LEN + n * prefix], n * width);
+
+        if (width == 1) {
+            dst[n] = (uint8_t)collect_value(tm, &stats, col);
+        } else {
+            sys_put_be16(collect_value(tm, &stats, col), &dst[n * width]);
+        }
+    }
+
+    payload[TM_DIAG_COLLECT_HDR_LEN + n] = tm->cfg.node_id;
+    payload[1] = n + 1;
+
+    return len + rec;
+}
+
+int tm_diag_collect_decode(const uint8_t *payload, size_t len, struct tm_diag_collect *snap)
+{
+    size_t off;
+
+    if (len < TM_DIAG_COLLECT_HDR_LEN) {
+        return -EINVAL;
+    }
+
+    snap->columns = payload[0];
+    snap->count = payload[1];
+    if (len != TM_DIAG_COLLECT_HDR_LEN + snap->count * tm_diag_collect_record_len(snap->columns)) {
+        return -EINVAL;
+    }
+
+    snap->node_ids = &payload[TM_DIAG_COLLECT_HDR_LEN];
+    off = TM_DIAG_COLLECT_HDR_LEN + snap->count;
+    for (int col = 0; col < TM_COLLECT_COLS; col++) {
+        size_t width = collect_width(snap->columns, col);
+
+        snap->cols[col] = width > 0 ? &payload[off] : NULL;
+        off += snap->count * width;
+    }
+
+    return 0;
+}
+
+uint16_t tm_diag_collect_get(const struct tm_diag_collect *snap, enum tm_collect_col col,
+                             size_t i)
+{
+    const uint8_t *p = snap->cols[col];
+
+    if (p == NULL || i >= snap->count) {
+        return 0;
+    }
+
+    return collect_widths[col] == 1 ? p[i] : sys_get_be16(&p[i * collect_widths[col]]);
+}
+
+void token_manager_hist_dump(struct token_manager *tm)
+{
+#ifdef CONFIG_TOKEN_MANAGER_HISTOGRAMS
+    for (int id = 0; id < TM_HIST_COUNT; id++) {
+        const struct tm_histogram *h = &tm->hist[id];
+        struct tm_histogram_summary s;
+        uint32_t low, high;
+
+        tm_hist_summarize(h, &s);
+        LOG_INF("node %u %s: n=%u min=%u p50=%u p90=%u p99=%u p99.9=%u max=%u mean=%u us",
+                tm->cfg.node_id, hist_names[id], s.count, s.min, s.p50, s.p90, s.p99, s.p999,
+                s.max, s.mean);
+
+        for (uint32_t i = 0; i < TM_HIST_BUCKETS; i++) {
+            if (h->buckets[i] == 0) {
+                continue;
+            }
+            tm_hist_bucket_range(i, &low, &high);
+            LOG_INF("  [%u..%u] %u", low, high, h->buckets[i]);
+        }
+    }
+
+#if TM_TELEM_HIST_NODES > 0
+    /* Telemetry of the start node, one line per node it has times for */
+    for (uint8_t i = 0; i < TM_TELEM_HIST_NODES; i++) {
+        struct tm_histogram_summary hold, fwd;
+
+        (void)token_manager_telemetry_get(tm, i, TM_TELEM_HOLD, &hold);
+        (void)token_manager_telemetry_get(tm, i, TM_TELEM_FORWARD, &fwd);
+        if (hold.count == 0 && fwd.count == 0) {
+            continue;
+        }
+        LOG_INF("node %u telemetry of node %u: hold p50=%u p99=%u max=%u, "
+                "forward p50=%u p99=%u max=%u us",
+                tm->cfg.node_id, i, hold.p50, hold.p99, hold.max, fwd.p50, fwd.p99, fwd.max);
+    }
+#endif
+#else
+    LOG_INF("Histograms disabled (CONFIG_TOKEN_MANAGER_HISTOGRAMS)");
+#endif
+}
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "tm_histogram.h"
+
+BUILD_ASSERT(TM_HIST_MAX_BITS > TM_HIST_SUB_BITS && TM_HIST_MAX_BITS <= 32,
+             "histogram range must exceed the sub-bucket resolution");
+
+static inline uint32_t hist_index(uint32_t value)
+{
+    if (value < TM_HIST_SUB_COUNT) {
+        return value;
+    }
+
+#if TM_HIST_MAX_BITS < 32
+    if (value >= (1UL << TM_HIST_MAX_BITS)) {
+        return TM_HIST_BUCKETS - 1;
+    }
+#endif
+
+    uint32_t msb = 31 - __builtin_clz(value);
+    uint32_t shift = msb - TM_HIST_SUB_BITS;
+
+    return ((shift + 1) << TM_HIST_SUB_BITS) + ((value >> shift) - TM_HIST_SUB_COUNT);
+}
+
+void tm_hist_bucket_range(uint32_t idx, uint32_t *low, uint32_t *high)
+{
+    if (idx < TM_HIST_SUB_COUNT) {
+        *low = idx;
+        *high = idx;
+        return;
+    }
+
+    uint32_t shift = (idx >> TM_HIST_SUB_BITS) - 1;
+    uint32_t sub = idx & (TM_HIST_SUB_COUNT - 1);
+
+    *low = (TM_HIST_SUB_COUNT + sub) << shift;
+    *high = *low + ((1UL << shift) - 1);
+}
+
+void tm_hist_reset(struct tm_histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT32_MAX;
+}
+
+void tm_hist_record(struct tm_histogram *h, uint32_t value)
+{
+    h->buckets[hist_index(value)]++;
+    h->count++;
+    h->sum += value;
+    h->min = MIN(h->min, value);
+    h->max = MAX(h->max, value);
+}
+
+uint32_t tm_hist_percentile(const struct tm_histogram *h, uint32_t permille)
+{
+    uint32_t low, high;
+    uint64_t target;
+    uint64_t seen = 0;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    /* Rank of the requested quantile, at least the first sample */
+    target = MAX(1, ((uint64_t)h->count * permille + 999) / 1000);
+
+    for (uint32_t i = 0; i < TM_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            tm_hist_bucket_range(i, &low, &high);
+            /* The exact extremes are known; never report beyond them */
+            return CLAMP(high, h->min, h->max);
+        }
+    }
+
+    return h->max;
+}
+
+void tm_hist_summarize(const struct tm_histogram *h, struct tm_histogram_summary *s)
+{
+    s->count = h->count;
+    s->min = h->count > 0 ? h->min : 0;
+    s->max = h->max;
+    s->mean = h->count > 0 ? (uint32_t)(h->sum / h->count) : 0;
+    s->p50 = tm_hist_percentile(h, 500);
+    s->p90 = tm_hist_percentile(h, 900);
+    s->p99 = tm_hist_percentile(h, 990);
+    s->p999 = tm_hist_percentile(h, 999);
+}
@@ -0,0 +1,126 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "tm_table.h"
+
+LOG_MODULE_DECLARE(token_manager, CONFIG_TOKEN_MANAGER_LOG_LEVEL);
+
+/* Type and key ahead of the record */
+#define TABLE_HDR_LEN 2
+/* A reader outranking the writer must not spin on an odd count forever */
+#define TABLE_READ_RETRIES 4
+
+BUILD_ASSERT(CONFIG_TOKEN_MANAGER_TABLE_RECORD_SIZE + TABLE_HDR_LEN <=
+                 CONFIG_TOKEN_MANAGER_MAILBOX_MAX_PAYLOAD,
+             "table records must fit a mailbox frame");
+
+static uint32_t table_now(struct tm_table *t)
+{
+    return t->tm->cfg.port.now_us(t->tm->cfg.port.ctx);
+}
+
+/* Seqlock write side; each entry has a single writer */
+static void table_store(struct tm_table_entry *e, const uint8_t *rec, size_t len,
+                        uint32_t now)
+{
+    atomic_inc(&e->seq);
+    memcpy(e->rec, rec, len);
+    e->len = (uint8_t)len;
+    e->updated_us = now;
+    atomic_inc(&e->seq);
+}
+
+static void table_snoop(struct token_manager *tm, const struct token_manager_rx_view *view,
+                        void *user_data)
+{
+    struct tm_table *t = user_data;
+    size_t len = view->len - MIN(view->len, TABLE_HDR_LEN);
+
+    if (view->src < ARRAY_SIZE(t->entries) && view->len >= TABLE_HDR_LEN &&
+        len <= CONFIG_TOKEN_MANAGER_TABLE_RECORD_SIZE) {
+        table_store(&t->entries[view->src], &view->payload[TABLE_HDR_LEN], len, table_now(t));
+    } else {
+        LOG_DBG("Table record from node %u dropped", view->src);
+    }
+
+    token_manager_rx_release(tm, view);
+}
+
+int tm_table_init(struct tm_table *t, struct token_manager *tm, uint8_t type)
+{
+    memset(t, 0, sizeof(*t));
+    t->tm = tm;
+    t->type = type;
+
+    t->mbox = token_manager_mailbox_open(tm, type, 0);
+    if (t->mbox < 0) {
+        return t->mbox;
+    }
+
+    t->sub = token_manager_subscribe(tm, TM_SUB_ANY, type, table_snoop, t);
+    if (t->sub < 0) {
+        return t->sub;
+    }
+
+    return 0;
+}
+
+int tm_table_publish(struct tm_table *t, const void *rec, size_t len)
+{
+    uint8_t id = t->tm->cfg.node_id;
+
+    if (len > CONFIG_TOKEN_MANAGER_TABLE_RECORD_SIZE) {
+        return -EMSGSIZE;
+    }
+
+    if (id < ARRAY_SIZE(t->entries)) {
+        table_store(&t->entries[id], rec, len, table_now(t));
+    }
+
+    return token_manager_mailbox_write(t->tm, t->mbox, rec, len);
+}
+
+int tm_table_read(struct tm_table *t, uint8_t node, void *rec, size_t size,
+                  uint32_t *updated_us)
+{
+    struct tm_table_entry *e;
+
+    if (node >= ARRAY_SIZE(t->entries)) {
+        return -EINVAL;
+    }
+
+    e = &t->entries[node];
+
+    for (int i = 0; i < TABLE_READ_RETRIES; i++) {
+        atomic_val_t seq = atomic_get(&e->seq);
+        uint8_t len = e->len;
+        uint32_t updated = e->updated_us;
+
+        if (seq == 0) {
+            return -ENODATA;
+        }
+        if (seq & 1) {
+            k_yield();
+            continue;
+        }
+        if (len <= size) {
+            memcpy(rec, e->rec, len);
+        }
+        if (atomic_get(&e->seq) != seq) {
+            continue;
+        }
+        if (len > size) {
+            return -ENOBUFS;
+        }
+
+        if (updated_us != NULL) {
+            *updated_us = updated;
+        }
+        return len;
+    }
+
+    return -EBUSY;
+}
@@ -0,0 +1,203 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/barrier.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "tm_trace.h"
+
+#if defined(CONFIG_TOKEN_MANAGER_TRACE_BACKEND_RTT)
+#include <SEGGER_RTT.h>
+#elif defined(CONFIG_TOKEN_MANAGER_TRACE_BACKEND_FILE)
+#include "tm_trace_native.h"
+#endif
+
+LOG_MODULE_REGISTER(tm_trace, CONFIG_TOKEN_MANAGER_LOG_LEVEL);
+
+#define TRACE_SLOTS       CONFIG_TOKEN_MANAGER_TRACE_RECORDS
+#define TRACE_MASK        (TRACE_SLOTS - 1)
+#define TRACE_RECORD_SIZE 8
+#define TRACE_BLOCK_HDR   8
+#define TRACE_STREAM_HDR  12
+
+BUILD_ASSERT(IS_POWER_OF_TWO(TRACE_SLOTS), "trace buffer size must be a power of two");
+
+struct trace_slot {
+    struct tm_trace_record rec;
+    /* Sequence number + 1 of the record in this slot, 0 while being written */
+    atomic_t seq;
+};
+
+struct trace_cpu_buf {
+    atomic_t head;
+    uint32_t tail;
+    uint32_t lost;
+    struct trace_slot slots[TRACE_SLOTS];
+};
+
+static struct trace_cpu_buf trace_bufs[CONFIG_MP_MAX_NUM_CPUS];
+
+void tm_trace_emit(uint8_t node, uint8_t event, uint16_t arg)
+{
+#if CONFIG_MP_MAX_NUM_CPUS > 1
+    struct trace_cpu_buf *tb = &trace_bufs[arch_curr_cpu()->id];
+#else
+    struct trace_cpu_buf *tb = &trace_bufs[0];
+#endif
+    uint32_t idx = (uint32_t)atomic_inc(&tb->head);
+    struct trace_slot *slot = &tb->slots[idx & TRACE_MASK];
+
+    /* Invalidate first so a concurrent reader cannot mix old and new fields */
+    atomic_set(&slot->seq, 0);
+    slot->rec.cycles = k_cycle_get_32();
+    slot->rec.arg = arg;
+    slot->rec.event = event;
+    slot->rec.node = node;
+    atomic_set(&slot->seq, (atomic_val_t)(idx + 1));
+}
+
+static size_t trace_drain_cpu(struct trace_cpu_buf *tb, uint8_t cpu, uint8_t *buf, size_t size)
+{
+    uint32_t head = (uint32_t)atomic_get(&tb->head);
+    uint16_t count = 0;
+    uint8_t *out = buf + TRACE_BLOCK_HDR;
+
+    if (size < TRACE_BLOCK_HDR + TRACE_RECORD_SIZE || head == tb->tail) {
+        return 0;
+    }
+
+    if (head - tb->tail > TRACE_SLOTS) {
+        /* Writers lapped the reader; the oldest records are gone */
+        tb->lost += head - tb->tail - TRACE_SLOTS;
+        tb->tail = head - TRACE_SLOTS;
+    }
+
+    while (tb->tail != head && (size_t)(out - buf) + TRACE_RECORD_SIZE <= size &&
+           count < UINT16_MAX) {
+        struct trace_slot *slot = &tb->slots[tb->tail & TRACE_MASK];
+        uint32_t seq = (uint32_t)atomic_get(&slot->seq);
+        int32_t ahead = (int32_t)(seq - (tb->tail + 1));
+
+        if (seq == 0 || ahead < 0) {
+            /* Reserved but still being filled: pick it up next time */
+            break;
+        }
+        tb->tail++;
+        if (ahead > 0) {
+            /* Already overwritten by a newer record */
+            tb->lost++;
+            continue;
+        }
+
+        /* Seqlock read: the copy counts only if seq is unchanged across it */
+        barrier_dmem_fence_full();
+        struct tm_trace_record rec = slot->rec;
+        barrier_dmem_fence_full();
+
+        if ((uint32_t)atomic_get(&slot->seq) != seq) {
+            /* Overwritten by a newer record while we were copying it */
+            tb->lost++;
+            continue;
+        }
+
+        sys_put_le32(rec.cycles, out);
+        sys_put_le16(rec.arg, out + 4);
+        out[6] = rec.event;
+        out[7] = rec.node;
+        out += TRACE_RECORD_SIZE;
+        count++;
+    }
+
+    if (count == 0 && tb->lost == 0) {
+        return 0;
+    }
+
+    buf[0] = TM_TRACE_BLOCK_MAGIC;
+    buf[1] = cpu;
+    sys_put_le16(count, buf + 2);
+    sys_put_le32(tb->lost, buf + 4);
+    tb->lost = 0;
+
+    return out - buf;
+}
+
+size_t tm_trace_drain(uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+
+    for (uint8_t cpu = 0; cpu < CONFIG_MP_MAX_NUM_CPUS; cpu++) {
+        len += trace_drain_cpu(&trace_bufs[cpu], cpu, buf + len, size - len);
+    }
+
+    return len;
+}
+
+#if defined(CONFIG_TOKEN_MANAGER_TRACE_BACKEND_RTT)
+
+static uint8_t rtt_up_buf[CONFIG_TOKEN_MANAGER_TRACE_RTT_BUFFER_SIZE];
+
+static int trace_backend_init(void)
+{
+    int ret = SEGGER_RTT_ConfigUpBuffer(CONFIG_TOKEN_MANAGER_TRACE_RTT_CHANNEL, "tm_trace",
+                                        rtt_up_buf, sizeof(rtt_up_buf),
+                                        SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+
+    return ret < 0 ? -EIO : 0;
+}
+
+static void trace_backend_write(const uint8_t *data, size_t len)
+{
+    SEGGER_RTT_Write(CONFIG_TOKEN_MANAGER_TRACE_RTT_CHANNEL, data, len);
+}
+
+#elif defined(CONFIG_TOKEN_MANAGER_TRACE_BACKEND_FILE)
+
+static int trace_fd = -1;
+
+static int trace_backend_init(void)
+{
+    trace_fd = tm_trace_native_open(CONFIG_TOKEN_MANAGER_TRACE_FILE);
+
+    return trace_fd < 0 ? -EIO : 0;
+}
+
+static void trace_backend_write(const uint8_t *data, size_t len)
+{
+    tm_trace_native_write(trace_fd, data, len);
+}
+
+#endif
+
+#if !defined(CONFIG_TOKEN_MANAGER_TRACE_BACKEND_NONE)
+
+static void trace_thread_fn(void *p1, void *p2, void *p3)
+{
+    static uint8_t chunk[512];
+
+    if (trace_backend_init() < 0) {
+        LOG_ERR("Trace backend init failed");
+        return;
+    }
+
+    memcpy(chunk, "TMTR", 4);
+    chunk[4] = TM_TRACE_VERSION;
+    chunk[5] = TRACE_RECORD_SIZE;
+    sys_put_le16(0, chunk + 6);
+    sys_put_le32(sys_clock_hw_cycles_per_sec(), chunk + 8);
+    trace_backend_write(chunk, TRACE_STREAM_HDR);
+
+    while (true) {
+        size_t len;
+
+        while ((len = tm_trace_drain(chunk, sizeof(chunk))) > 0) {
+            trace_backend_write(chunk, len);
+        }
+        k_sleep(K_MSEC(CONFIG_TOKEN_MANAGER_TRACE_FLUSH_MS));
+    }
+}
+
+K_THREAD_DEFINE(tm_trace_thread, 1024, trace_thread_fn, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+#endif /* !CONFIG_TOKEN_MANAGER_TRACE_BACKEND_NONE */
@@ -0,0 +1,15 @@
+/*
+ * Host-side file output for the trace and capture streams on native_sim.
+ * Implemented in tm_trace_native_bottom.c, which is built against the host
+ * C library.
+ */
+
+#ifndef TM_TRACE_NATIVE_H_
+#define TM_TRACE_NATIVE_H_
+
+#include <stddef.h>
+
+int tm_trace_native_open(const char *path);
+int tm_trace_native_write(int fd, const void *data, size_t len);
+
+#endif /* TM_TRACE_NATIVE_H_ */
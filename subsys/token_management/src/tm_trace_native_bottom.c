@@ -0,0 +1,14 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tm_trace_native.h"
+
+int tm_trace_native_open(const char *path)
+{
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+int tm_trace_native_write(int fd, const void *data, size_t len)
+{
+    return (int)write(fd, data, len);
+}
@@ -0,0 +1,498 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+#include "token_frame.h"
+
+uint16_t tm_frame_crc(const uint8_t *buf, size_t len)
+{
+    return crc16_ccitt(TM_CRC_INIT, buf, len);
+}
+
+uint16_t tm_frame_crc_update(uint16_t crc, const uint8_t *buf, size_t len)
+{
+    return crc16_ccitt(crc, buf, len);
+}
+
+size_t tm_frame_encode_token(uint8_t *buf, size_t size, uint8_t token_id)
+{
+    if (size < TM_TOKEN_FRAME_LEN) {
+        return 0;
+    }
+
+    buf[0] = TM_TOKEN_DELIMITER;
+    buf[1] = token_id;
+    sys_put_be16(tm_frame_crc(buf, TM_TOKEN_HDR_LEN), &buf[TM_TOKEN_HDR_LEN]);
+
+    return TM_TOKEN_FRAME_LEN;
+}
+
+size_t tm_frame_encode_sync(uint8_t *buf, size_t size, const struct tm_sync *sync)
+{
+    if (size < TM_SYNC_FRAME_LEN) {
+        return 0;
+    }
+
+    buf[0] = TM_SYNC_DELIMITER;
+    buf[1] = sync->hops;
+    buf[2] = sync->seq;
+    sys_put_be32(sync->origin_us, &buf[3]);
+    sys_put_be32(sync->correction_us, &buf[7]);
+    sys_put_be16(sync->hop_us, &buf[11]);
+    sys_put_be16(tm_frame_crc(buf, TM_SYNC_HDR_LEN), &buf[TM_SYNC_HDR_LEN]);
+
+    return TM_SYNC_FRAME_LEN;
+}
+
+size_t tm_frame_encode_agg_token(uint8_t *buf, size_t size, uint8_t token_id,
+                                 const uint8_t *fields, size_t n)
+{
+    size_t body = TM_AGG_HDR_LEN + n * TM_AGG_FIELD_LEN;
+
+    if (n > TM_AGG_MAX_FIELDS || size < body + TM_CRC_LEN) {
+        return 0;
+    }
+
+    buf[0] = TM_AGG_DELIMITER;
+    buf[1] = token_id;
+    buf[2] = (uint8_t)n;
+    memcpy(&buf[TM_AGG_HDR_LEN], fields, n * TM_AGG_FIELD_LEN);
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+size_t tm_frame_encode_seen_token(uint8_t *buf, size_t size, uint8_t token_id,
+                                  const uint8_t *fields, size_t n, const uint8_t *seen,
+                                  size_t n_seen)
+{
+    size_t body = TM_SEEN_FRAME_LEN(n, n_seen) - TM_CRC_LEN;
+    size_t off = TM_SEEN_HDR_LEN + n * TM_AGG_FIELD_LEN;
+
+    if (n > TM_AGG_MAX_FIELDS || n_seen > TM_SEEN_MAX || size < body + TM_CRC_LEN) {
+        return 0;
+    }
+
+    buf[0] = TM_SEEN_DELIMITER;
+    buf[1] = token_id;
+    buf[2] = (uint8_t)n;
+    buf[3] = (uint8_t)n_seen;
+    memcpy(&buf[TM_SEEN_HDR_LEN], fields, n * TM_AGG_FIELD_LEN);
+    memcpy(&buf[off], seen, n_seen * TM_SEEN_REPORT_LEN);
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+size_t tm_frame_encode_telem_token(uint8_t *buf, size_t size, uint8_t token_id,
+                                   const uint8_t *fields, size_t n, const uint8_t *seen,
+                                   size_t n_seen, const uint8_t *telem, size_t n_telem)
+{
+    size_t body = TM_TELEM_FRAME_LEN(n, n_seen, n_telem) - TM_CRC_LEN;
+    size_t off = TM_TELEM_HDR_LEN + n * TM_AGG_FIELD_LEN;
+
+    if (n > TM_AGG_MAX_FIELDS || n_seen > TM_SEEN_MAX || n_telem > TM_TELEM_MAX_NODES ||
+        size < body + TM_CRC_LEN) {
+        return 0;
+    }
+
+    buf[0] = TM_TELEM_DELIMITER;
+    buf[1] = token_id;
+    buf[2] = (uint8_t)n;
+    buf[3] = (uint8_t)n_seen;
+    buf[4] = (uint8_t)n_telem;
+    memcpy(&buf[TM_TELEM_HDR_LEN], fields, n * TM_AGG_FIELD_LEN);
+    memcpy(&buf[off], seen, n_seen * TM_SEEN_REPORT_LEN);
+    off += n_seen * TM_SEEN_REPORT_LEN;
+    memcpy(&buf[off], telem, n_telem * TM_TELEM_SLOT_LEN);
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+size_t tm_frame_finish_slot(uint8_t *buf, uint8_t ctrl, uint8_t src, uint8_t dst, size_t len,
+                            size_t size)
+{
+    size_t body = TM_SLOT_HDR_LEN + size;
+
+    buf[0] = TM_SLOT_DELIMITER;
+    buf[1] = ctrl;
+    buf[2] = src;
+    buf[3] = dst;
+    buf[4] = (uint8_t)len;
+    memset(&buf[TM_SLOT_HDR_LEN + len], 0, size - len);
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+void tm_frame_agg_field_get(const uint8_t *fields, size_t i, struct tm_agg_field *field)
+{
+    const uint8_t *f = &fields[i * TM_AGG_FIELD_LEN];
+
+    field->op = f[0];
+    field->result = (int32_t)sys_get_be32(&f[1]);
+    field->acc = (int32_t)sys_get_be32(&f[5]);
+}
+
+void tm_frame_agg_field_put(uint8_t *fields, size_t i, const struct tm_agg_field *field)
+{
+    uint8_t *f = &fields[i * TM_AGG_FIELD_LEN];
+
+    f[0] = field->op;
+    sys_put_be32((uint32_t)field->result, &f[1]);
+    sys_put_be32((uint32_t)field->acc, &f[5]);
+}
+
+void tm_frame_seen_get(const uint8_t *seen, size_t i, struct tm_seen_report *report)
+{
+    const uint8_t *r = &seen[i * TM_SEEN_REPORT_LEN];
+
+    report->src = r[0];
+    report->dst = r[1];
+    report->frames = r[2];
+}
+
+void tm_frame_seen_put(uint8_t *seen, size_t i, const struct tm_seen_report *report)
+{
+    uint8_t *r = &seen[i * TM_SEEN_REPORT_LEN];
+
+    r[0] = report->src;
+    r[1] = report->dst;
+    r[2] = report->frames;
+}
+
+void tm_frame_telem_get(const uint8_t *telem, size_t i, struct tm_telem_slot *slot)
+{
+    const uint8_t *t = &telem[i * TM_TELEM_SLOT_LEN];
+
+    slot->hold_us = sys_get_be16(&t[0]);
+    slot->fwd_us = sys_get_be16(&t[2]);
+}
+
+void tm_frame_telem_put(uint8_t *telem, size_t i, const struct tm_telem_slot *slot)
+{
+    uint8_t *t = &telem[i * TM_TELEM_SLOT_LEN];
+
+    sys_put_be16(slot->hold_us, &t[0]);
+    sys_put_be16(slot->fwd_us, &t[2]);
+}
+
+size_t tm_frame_finish_data(uint8_t *buf, uint8_t node_id, size_t len)
+{
+    size_t body = TM_DATA_HDR_LEN + len;
+
+    buf[0] = TM_DATA_DELIMITER;
+    buf[1] = node_id;
+    buf[2] = (uint8_t)len;
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+size_t tm_frame_finish_addr(uint8_t *buf, uint8_t node_id, uint8_t dst, size_t len)
+{
+    size_t body = TM_DATA_HDR_LEN + len + 1;
+
+    buf[0] = TM_ADDR_DELIMITER;
+    buf[1] = node_id;
+    buf[2] = (uint8_t)len;
+    buf[body - 1] = dst;
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+size_t tm_frame_encode_data(uint8_t *buf, size_t size, uint8_t node_id,
+                            const uint8_t *payload, size_t len)
+{
+    if (len > TM_MAX_PAYLOAD || size < TM_DATA_FRAME_LEN(len)) {
+        return 0;
+    }
+
+    if (len > 0) {
+        memcpy(&buf[TM_DATA_HDR_LEN], payload, len);
+    }
+
+    return tm_frame_finish_data(buf, node_id, len);
+}
+
+size_t tm_frame_finish_diag(uint8_t *buf, uint8_t src, uint8_t dst, uint8_t kind, size_t len)
+{
+    size_t body = TM_DIAG_HDR_LEN + len;
+
+    buf[0] = TM_DIAG_DELIMITER;
+    buf[1] = src;
+    buf[2] = dst;
+    buf[3] = kind;
+    buf[4] = (uint8_t)len;
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+size_t tm_frame_encode_diag(uint8_t *buf, size_t size, uint8_t src, uint8_t dst, uint8_t kind,
+                            const uint8_t *payload, size_t len)
+{
+    if (len > TM_MAX_PAYLOAD || size < TM_DIAG_FRAME_LEN(len)) {
+        return 0;
+    }
+
+    if (len > 0) {
+        memcpy(&buf[TM_DIAG_HDR_LEN], payload, len);
+    }
+
+    return tm_frame_finish_diag(buf, src, dst, kind, len);
+}
+
+size_t tm_frame_encode_pdata(uint8_t *buf, size_t size, uint8_t src, uint8_t wkc,
+                             const uint8_t *datagram, size_t len)
+{
+    size_t body = TM_PDATA_HDR_LEN + len;
+
+    if (len > TM_MAX_PAYLOAD || size < body + TM_CRC_LEN) {
+        return 0;
+    }
+
+    buf[0] = TM_PDATA_DELIMITER;
+    buf[1] = src;
+    buf[2] = wkc;
+    buf[3] = (uint8_t)len;
+    if (len > 0) {
+        memcpy(&buf[TM_PDATA_HDR_LEN], datagram, len);
+    }
+    sys_put_be16(tm_frame_crc(buf, body), &buf[body]);
+
+    return body + TM_CRC_LEN;
+}
+
+int tm_frame_decode(const uint8_t *buf, size_t len, struct tm_frame *frame)
+{
+    size_t body;
+
+    if (len < TM_TOKEN_FRAME_LEN) {
+        return -EINVAL;
+    }
+
+    switch (buf[0]) {
+    case TM_TOKEN_DELIMITER:
+        if (len != TM_TOKEN_FRAME_LEN) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_TOKEN;
+        frame->token_id = buf[1];
+        body = TM_TOKEN_HDR_LEN;
+        break;
+    case TM_AGG_DELIMITER:
+        if (len < TM_AGG_FRAME_LEN(0) || buf[2] > TM_AGG_MAX_FIELDS ||
+            len != TM_AGG_FRAME_LEN(buf[2])) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_TOKEN;
+        frame->token_id = buf[1];
+        frame->len = buf[2];
+        frame->payload = &buf[TM_AGG_HDR_LEN];
+        body = TM_AGG_HDR_LEN + buf[2] * TM_AGG_FIELD_LEN;
+        break;
+    case TM_SEEN_DELIMITER:
+        if (len < TM_SEEN_FRAME_LEN(0, 0) || buf[2] > TM_AGG_MAX_FIELDS ||
+            buf[3] > TM_SEEN_MAX || len != TM_SEEN_FRAME_LEN(buf[2], buf[3])) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_TOKEN;
+        frame->token_id = buf[1];
+        frame->len = buf[2];
+        frame->payload = &buf[TM_SEEN_HDR_LEN];
+        frame->n_seen = buf[3];
+        frame->seen = &buf[TM_SEEN_HDR_LEN + buf[2] * TM_AGG_FIELD_LEN];
+        body = len - TM_CRC_LEN;
+        break;
+    case TM_TELEM_DELIMITER:
+        if (len < TM_TELEM_FRAME_LEN(0, 0, 0) || buf[2] > TM_AGG_MAX_FIELDS ||
+            buf[3] > TM_SEEN_MAX || buf[4] > TM_TELEM_MAX_NODES ||
+            len != TM_TELEM_FRAME_LEN(buf[2], buf[3], buf[4])) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_TOKEN;
+        frame->token_id = buf[1];
+        frame->len = buf[2];
+        frame->payload = &buf[TM_TELEM_HDR_LEN];
+        frame->n_seen = buf[3];
+        frame->seen = &buf[TM_TELEM_HDR_LEN + buf[2] * TM_AGG_FIELD_LEN];
+        frame->n_telem = buf[4];
+        frame->telem = &frame->seen[buf[3] * TM_SEEN_REPORT_LEN];
+        body = len - TM_CRC_LEN;
+        break;
+    case TM_SYNC_DELIMITER:
+        if (len != TM_SYNC_FRAME_LEN) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_SYNC;
+        frame->sync.hops = buf[1];
+        frame->sync.seq = buf[2];
+        frame->sync.origin_us = sys_get_be32(&buf[3]);
+        frame->sync.correction_us = sys_get_be32(&buf[7]);
+        frame->sync.hop_us = sys_get_be16(&buf[11]);
+        body = TM_SYNC_HDR_LEN;
+        break;
+    case TM_DATA_DELIMITER:
+        if (len < TM_DATA_FRAME_LEN(0) || len != TM_DATA_FRAME_LEN(buf[2])) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_DATA;
+        frame->node_id = buf[1];
+        frame->dst = TM_BROADCAST;
+        frame->len = buf[2];
+        frame->payload = &buf[TM_DATA_HDR_LEN];
+        body = TM_DATA_HDR_LEN + buf[2];
+        break;
+    case TM_ADDR_DELIMITER:
+        if (len < TM_ADDR_FRAME_LEN(0) || len != TM_ADDR_FRAME_LEN(buf[2])) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_DATA;
+        frame->node_id = buf[1];
+        frame->len = buf[2];
+        frame->payload = &buf[TM_DATA_HDR_LEN];
+        body = TM_DATA_HDR_LEN + buf[2] + 1;
+        frame->dst = buf[body - 1];
+        break;
+    case TM_DIAG_DELIMITER:
+        if (len < TM_DIAG_FRAME_LEN(0) || len != TM_DIAG_FRAME_LEN(buf[4])) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_DIAG;
+        frame->node_id = buf[1];
+        frame->dst = buf[2];
+        frame->kind = buf[3];
+        frame->len = buf[4];
+        frame->payload = &buf[TM_DIAG_HDR_LEN];
+        body = TM_DIAG_HDR_LEN + buf[4];
+        break;
+    case TM_PDATA_DELIMITER:
+        if (len < TM_PDATA_FRAME_LEN(0) || len != TM_PDATA_FRAME_LEN(buf[3])) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_PDATA;
+        frame->node_id = buf[1];
+        frame->wkc = buf[2] & TM_PDATA_WKC_MASK;
+        frame->len = buf[3];
+        frame->payload = &buf[TM_PDATA_HDR_LEN];
+        body = TM_PDATA_HDR_LEN + buf[3];
+        break;
+    case TM_SLOT_DELIMITER:
+        /* Every slot has the ring's size; the length is what it carries */
+        if (len < TM_SLOT_FRAME_LEN(0) || buf[4] > len - TM_SLOT_FRAME_LEN(0)) {
+            return -EINVAL;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->type = TM_FRAME_SLOT;
+        frame->ctrl = buf[1];
+        frame->node_id = buf[2];
+        frame->dst = buf[3];
+        frame->len = buf[4];
+        frame->payload = &buf[TM_SLOT_HDR_LEN];
+        body = len - TM_CRC_LEN;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (sys_get_be16(&buf[body]) != tm_frame_crc(buf, body)) {
+        return -EBADMSG;
+    }
+
+    return 0;
+}
+
+void tm_frame_decoder_reset(struct tm_frame_decoder *dec)
+{
+    dec->pos = 0;
+    dec->need = 0;
+}
+
+size_t tm_frame_decoder_feed(struct tm_frame_decoder *dec, const uint8_t *data, size_t len,
+                             tm_frame_cb_t cb, void *user_data)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = data[i];
+
+        if (dec->pos == 0) {
+            /* Hunt for a start delimiter */
+            if (dec->cut_through != 0 && byte == dec->cut_through) {
+                return i;
+            } else if (byte == TM_TOKEN_DELIMITER) {
+                dec->need = TM_TOKEN_FRAME_LEN;
+            } else if (byte == TM_AGG_DELIMITER) {
+                dec->need = TM_AGG_HDR_LEN;
+            } else if (byte == TM_SEEN_DELIMITER) {
+                dec->need = TM_SEEN_HDR_LEN;
+            } else if (byte == TM_TELEM_DELIMITER) {
+                dec->need = TM_TELEM_HDR_LEN;
+            } else if (byte == TM_SYNC_DELIMITER) {
+                dec->need = TM_SYNC_FRAME_LEN;
+            } else if (byte == TM_DATA_DELIMITER || byte == TM_ADDR_DELIMITER) {
+                dec->need = TM_DATA_HDR_LEN;
+            } else if (byte == TM_DIAG_DELIMITER) {
+                dec->need = TM_DIAG_HDR_LEN;
+            } else if (byte == TM_PDATA_DELIMITER) {
+                dec->need = TM_PDATA_HDR_LEN;
+            } else if (byte == TM_SLOT_DELIMITER && dec->slot_size > 0) {
+                dec->need = TM_SLOT_FRAME_LEN(dec->slot_size);
+            } else {
+                continue;
+            }
+        }
+
+        dec->buf[dec->pos++] = byte;
+
+        /* The length byte closes the header: extend to the full frame */
+        if (dec->buf[0] == TM_AGG_DELIMITER && dec->pos == TM_AGG_HDR_LEN) {
+            if (byte > TM_AGG_MAX_FIELDS) {
+                /* Would overrun buf; resynchronise on the next delimiter */
+                dec->pos = 0;
+                continue;
+            }
+            dec->need = TM_AGG_FRAME_LEN(byte);
+        } else if (dec->buf[0] == TM_SEEN_DELIMITER && dec->pos == TM_SEEN_HDR_LEN) {
+            if (dec->buf[2] > TM_AGG_MAX_FIELDS || byte > TM_SEEN_MAX) {
+                dec->pos = 0;
+                continue;
+            }
+            dec->need = TM_SEEN_FRAME_LEN(dec->buf[2], byte);
+        } else if (dec->buf[0] == TM_TELEM_DELIMITER && dec->pos == TM_TELEM_HDR_LEN) {
+            if (dec->buf[2] > TM_AGG_MAX_FIELDS || dec->buf[3] > TM_SEEN_MAX ||
+                byte > TM_TELEM_MAX_NODES) {
+                dec->pos = 0;
+                continue;
+            }
+            dec->need = TM_TELEM_FRAME_LEN(dec->buf[2], dec->buf[3], byte);
+        } else if (dec->buf[0] == TM_DATA_DELIMITER && dec->pos == TM_DATA_HDR_LEN) {
+            dec->need = TM_DATA_FRAME_LEN(byte);
+        } else if (dec->buf[0] == TM_ADDR_DELIMITER && dec->pos == TM_DATA_HDR_LEN) {
+            dec->need = TM_ADDR_FRAME_LEN(byte);
+        } else if (dec->buf[0] == TM_DIAG_DELIMITER && dec->pos == TM_DIAG_HDR_LEN) {
+            dec->need = TM_DIAG_FRAME_LEN(byte);
+        } else if (dec->buf[0] == TM_PDATA_DELIMITER && dec->pos == TM_PDATA_HDR_LEN) {
+            dec->need = TM_PDATA_FRAME_LEN(byte);
+        }
+
+        if (dec->pos == dec->need) {
+            cb(dec->buf, dec->pos, user_data);
+            dec->pos = 0;
+        }
+    }
+
+    return len;
+}
@@ -0,0 +1,2361 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/barrier.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "tm_capture.h"
+#include "tm_diag.h"
+#include "tm_trace.h"
+#include "token_manager.h"
+
+LOG_MODULE_REGISTER(token_manager, CONFIG_TOKEN_MANAGER_LOG_LEVEL);
+
+static inline uint32_t tm_now(struct token_manager *tm)
+{
+    return tm->cfg.port.now_us(tm->cfg.port.ctx);
+}
+
+static inline void tm_set_state(struct token_manager *tm, enum token_manager_state state)
+{
+    tm->state = state;
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_STATE, state);
+}
+
+#ifdef CONFIG_TOKEN_MANAGER_HISTOGRAMS
+static inline void tm_hist(struct token_manager *tm, enum tm_hist_id id, uint32_t value)
+{
+    tm_hist_record(&tm->hist[id], value);
+}
+
+/* Own data frames return in the order they were sent within a hold */
+static inline void tm_stamp_tx(struct token_manager *tm)
+{
+    if (tm->tx_sent < TM_TX_STAMPS) {
+        tm->tx_stamp_us[tm->tx_sent] = tm_now(tm);
+    }
+    tm->tx_sent++;
+}
+
+static inline void tm_stamp_return(struct token_manager *tm)
+{
+    if (tm->tx_returned < MIN(tm->tx_sent, TM_TX_STAMPS)) {
+        tm_hist(tm, TM_HIST_FRAME_LATENCY, tm_now(tm) - tm->tx_stamp_us[tm->tx_returned]);
+    }
+    tm->tx_returned++;
+}
+
+/* Frames of the previous hold returned ahead of the token */
+static inline void tm_stamp_reset(struct token_manager *tm)
+{
+    tm->tx_sent = 0;
+    tm->tx_returned = 0;
+}
+#else
+static inline void tm_hist(struct token_manager *tm, enum tm_hist_id id, uint32_t value)
+{
+}
+
+static inline void tm_stamp_tx(struct token_manager *tm)
+{
+}
+
+static inline void tm_stamp_return(struct token_manager *tm)
+{
+}
+
+static inline void tm_stamp_reset(struct token_manager *tm)
+{
+}
+#endif
+
+/* Index of a circulating token, kept in the low bits of its ID */
+static inline uint8_t tm_token_index(const struct token_manager *tm, uint8_t token_id)
+{
+    return token_id & (tm->cfg.tokens - 1);
+}
+
+/* Index of the token a data frame goes out on, from its message type */
+static inline uint8_t tm_frame_token(const struct token_manager *tm, const uint8_t *frame)
+{
+    return frame[2] > 0 ? tm_token_index(tm, frame[TM_DATA_HDR_LEN]) : 0;
+}
+
+/* Length of a data frame in a TX slot, addressed or not */
+static inline size_t tm_slot_frame_len(const uint8_t *frame)
+{
+    return frame[0] == TM_ADDR_DELIMITER ? TM_ADDR_FRAME_LEN(frame[2])
+                                         : TM_DATA_FRAME_LEN(frame[2]);
+}
+
+static inline int tm_tx(struct token_manager *tm, const uint8_t *buf, size_t len)
+{
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_TX, len);
+    return tm->cfg.port.tx(tm->cfg.port.ctx, buf, len);
+}
+
+enum tm_hold_mode {
+    /* One port write per frame */
+    TM_HOLD_DIRECT,
+    /*
+     * Frames copied into tx_batch, one port write; with double buffering
+     * the first frame is written on its own
+     */
+    TM_HOLD_BATCH,
+    /* Data frames sent in place from their slots, one gather write */
+    TM_HOLD_GATHER,
+};
+
+/* Clock sync: departure of token 0 */
+enum tm_clk_tx {
+    /* Not sent in a gather write, so when it left is not known */
+    TM_CLK_TX_NONE,
+    TM_CLK_TX_PENDING,
+    /* Stamped in clk_tx_us */
+    TM_CLK_TX_DONE,
+};
+
+static void tm_release_inflight(struct token_manager *tm)
+{
+    struct tm_mpsc_node *n = tm->tx_inflight;
+
+    tm->tx_inflight = NULL;
+    while (n != NULL) {
+        struct token_manager_tx_slot *slot = CONTAINER_OF(n, struct token_manager_tx_slot, node);
+
+        n = n->next;
+        atomic_set_bit(tm->tx_free, slot - tm->tx_slots);
+    }
+}
+
+#if CONFIG_TOKEN_MANAGER_TX_BATCH_SIZE > 0
+static uint8_t *tm_batch_alloc(struct token_manager *tm, size_t len)
+{
+    uint8_t *buf = &tm->tx_batch[tm->tx_batch_len];
+
+    if (tm->tx_batch_len + len > sizeof(tm->tx_batch)) {
+        return NULL;
+    }
+    tm->tx_batch_len += len;
+
+    return buf;
+}
+#else
+static uint8_t *tm_batch_alloc(struct token_manager *tm, size_t len)
+{
+    return NULL;
+}
+#endif
+
+/* Append a segment, merging it with the previous one if they are adjacent */
+static bool tm_hold_seg(struct token_manager *tm, const uint8_t *buf, size_t len)
+{
+    if (tm->tx_n_segs > 0) {
+        struct token_manager_tx_seg *last = &tm->tx_segs[tm->tx_n_segs - 1];
+
+        if (last->buf + last->len == buf) {
+            last->len += len;
+            return true;
+        }
+    }
+    if (tm->tx_n_segs == ARRAY_SIZE(tm->tx_segs)) {
+        return false;
+    }
+
+    tm->tx_segs[tm->tx_n_segs++] = (struct token_manager_tx_seg){buf, len};
+
+    return true;
+}
+
+static inline size_t tm_hold_seg_bytes(struct token_manager *tm)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < tm->tx_n_segs; i++) {
+        len += tm->tx_segs[i].len;
+    }
+
+    return len;
+}
+
+static void tm_hold_begin(struct token_manager *tm)
+{
+    /* tx_batch and tx_token may still be on the wire from the last gather */
+    bool busy = atomic_get(&tm->tx_gather_busy);
+
+    if (tm->cfg.port.tx_gather != NULL && !busy) {
+        tm->hold_mode = TM_HOLD_GATHER;
+    } else if (CONFIG_TOKEN_MANAGER_TX_BATCH_SIZE > 0 && !busy) {
+        tm->hold_mode = TM_HOLD_BATCH;
+    } else {
+        tm->hold_mode = TM_HOLD_DIRECT;
+    }
+    tm->hold_flushed = false;
+}
+
+/* Hand everything gathered so far in this hold to the port */
+static void tm_hold_flush(struct token_manager *tm)
+{
+    int ret = 0;
+
+    if (tm->hold_mode == TM_HOLD_GATHER && tm->tx_n_segs > 0) {
+        TM_TRACE(tm->cfg.node_id, TM_TRACE_TX, tm_hold_seg_bytes(tm));
+        atomic_set(&tm->tx_gather_busy, 1);
+        ret = tm->cfg.port.tx_gather(tm->cfg.port.ctx, tm->tx_segs, tm->tx_n_segs);
+        if (ret < 0) {
+            tm_release_inflight(tm);
+            atomic_clear(&tm->tx_gather_busy);
+        }
+        /* Only one gather write may be outstanding */
+        tm->hold_mode = TM_HOLD_DIRECT;
+    }
+#if CONFIG_TOKEN_MANAGER_TX_BATCH_SIZE > 0
+    else if (tm->hold_mode == TM_HOLD_BATCH && tm->tx_batch_len > 0) {
+        ret = tm_tx(tm, tm->tx_batch, tm->tx_batch_len);
+    }
+#endif
+
+    if (ret < 0) {
+        LOG_ERR("Hold TX failed: %d", ret);
+    } else {
+        tm->stats.frames_tx += tm->tx_batch_data;
+    }
+
+    tm->hold_flushed = true;
+    tm->tx_n_segs = 0;
+    tm->tx_batch_len = 0;
+    tm->tx_batch_data = 0;
+}
+
+/*
+ * Queue one frame of the current hold. A frame in a TX slot may be sent in
+ * place, in which case the slot is freed by token_manager_tx_done().
+ */
+static void tm_hold_tx(struct token_manager *tm, const uint8_t *buf, size_t len,
+                       struct token_manager_tx_slot *slot)
+{
+    /* Every data frame in a hold is one of our own */
+    bool data = buf[0] == TM_DATA_DELIMITER || buf[0] == TM_ADDR_DELIMITER;
+    uint8_t *copy;
+
+    if (tm->hold_mode == TM_HOLD_GATHER) {
+        /* tx_token and tx_clk outlive the write like a slot does; anything else is copied */
+        bool in_place = slot != NULL || buf == tm->tx_token || buf == tm->tx_clk;
+
+        copy = in_place ? NULL : tm_batch_alloc(tm, len);
+        if ((in_place || copy != NULL) && tm_hold_seg(tm, in_place ? buf : copy, len)) {
+            if (copy != NULL) {
+                memcpy(copy, buf, len);
+            }
+            if (slot != NULL) {
+                slot->node.next = tm->tx_inflight;
+                tm->tx_inflight = &slot->node;
+            }
+            tm->tx_batch_data += data;
+            return;
+        }
+        tm_hold_flush(tm);
+    } else if (tm->hold_mode == TM_HOLD_BATCH) {
+        copy = tm_batch_alloc(tm, len);
+        if (copy == NULL) {
+            tm_hold_flush(tm);
+            copy = tm_batch_alloc(tm, len);
+        }
+        if (copy != NULL) {
+            memcpy(copy, buf, len);
+            tm->tx_batch_data += data;
+            if (slot != NULL) {
+                atomic_set_bit(tm->tx_free, slot - tm->tx_slots);
+            }
+            /* Start the line on the first frame; the rest is prepared meanwhile */
+            if (IS_ENABLED(CONFIG_TOKEN_MANAGER_TX_DOUBLE_BUFFER) && !tm->hold_flushed) {
+                tm_hold_flush(tm);
+            }
+            return;
+        }
+    }
+
+    /* The port copies the frame before returning */
+    int ret = tm_tx(tm, buf, len);
+    if (ret < 0) {
+        LOG_ERR("Hold TX failed: %d", ret);
+    } else if (data) {
+        tm->stats.frames_tx++;
+    }
+    if (slot != NULL) {
+        atomic_set_bit(tm->tx_free, slot - tm->tx_slots);
+    }
+}
+
+/* Add this node's record to the collect snapshot in tx_frame and reseal it */
+static size_t tm_collect_append(struct token_manager *tm, uint8_t src, uint8_t dst, size_t len)
+{
+    len = tm_diag_collect_append(tm, &tm->tx_frame[TM_DIAG_HDR_LEN], len);
+
+    return tm_frame_finish_diag(tm->tx_frame, src, dst, TM_DIAG_COLLECT, len);
+}
+
+static void tm_send_diag_frames(struct token_manager *tm)
+{
+    struct token_manager_diag_msg msg;
+
+    while (k_msgq_get(&tm->diag_q, &msg, K_NO_WAIT) == 0) {
+        size_t len = tm_frame_encode_diag(tm->tx_frame, sizeof(tm->tx_frame), tm->cfg.node_id,
+                                          msg.dst, msg.kind, msg.payload, msg.len);
+
+        if (msg.kind == TM_DIAG_COLLECT) {
+            len = tm_collect_append(tm, tm->cfg.node_id, msg.dst, msg.len);
+        }
+        tm_hold_tx(tm, tm->tx_frame, len, NULL);
+    }
+}
+
+/* This node's slot lies within a datagram of len bytes */
+static inline bool tm_pd_has_slot(struct token_manager *tm, size_t len)
+{
+    const struct token_manager_config *cfg = &tm->cfg;
+
+    return cfg->pd_cb != NULL && cfg->pd_len > 0 && cfg->pd_offset + cfg->pd_len <= len;
+}
+
+/* A process data header worth passing on, rather than line noise that looks like one */
+static inline bool tm_pd_hdr_valid(struct token_manager *tm, const uint8_t *hdr)
+{
+    uint8_t nodes = tm->cfg.pd_nodes;
+
+    return hdr[1] != TM_BROADCAST && hdr[3] <= CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN &&
+           (nodes == 0 || (hdr[1] < nodes && (hdr[2] & TM_PDATA_WKC_MASK) <= nodes));
+}
+
+/* The pending datagram, with our own slot exchanged before it leaves */
+static void tm_send_pdata(struct token_manager *tm)
+{
+    const struct token_manager_config *cfg = &tm->cfg;
+    uint8_t wkc = 0;
+    size_t len;
+
+    if (!tm->pd_tx_pending) {
+        return;
+    }
+    tm->pd_tx_pending = false;
+
+    if (tm_pd_has_slot(tm, tm->pd_tx_len)) {
+        cfg->pd_cb(tm, &tm->pd_tx[cfg->pd_offset], cfg->pd_len, cfg->user_data);
+        wkc = 1;
+    }
+
+    len = tm_frame_encode_pdata(tm->tx_frame, sizeof(tm->tx_frame), cfg->node_id, wkc,
+                                tm->pd_tx, tm->pd_tx_len);
+    tm_hold_tx(tm, tm->tx_frame, len, NULL);
+}
+
+/* Move every frame committed since the last hold behind the pending ones */
+static void tm_take_committed(struct token_manager *tm)
+{
+    struct tm_mpsc_node *batch = tm_mpsc_take_all(&tm->tx_q);
+
+    if (batch == NULL) {
+        return;
+    }
+
+    if (tm->tx_pending == NULL) {
+        tm->tx_pending = batch;
+    } else {
+        tm->tx_pending_tail->next = batch;
+    }
+
+    for (struct tm_mpsc_node *n = batch; n != NULL; n = n->next) {
+        tm->tx_pending_tail = n;
+        tm->tx_pending_count++;
+    }
+}
+
+/*
+ * Copy a mailbox frame out under its sequence count. Returns false if a
+ * writer was updating it; that writer marks the slot dirty again when done.
+ */
+static bool tm_mbox_read(struct token_manager_mbox *mb, uint8_t *buf, size_t *len)
+{
+    atomic_val_t seq = atomic_get(&mb->seq);
+
+    if (seq & 1) {
+        return false;
+    }
+
+    /* A torn length byte is caught by the recheck, but must not overrun */
+    *len = MIN(TM_DATA_FRAME_LEN(mb->frame[2]), sizeof(mb->frame));
+    memcpy(buf, mb->frame, *len);
+
+    return atomic_get(&mb->seq) == seq;
+}
+
+/*
+ * Send the newest value of every updated mailbox slot granted by token tok;
+ * returns frames sent
+ */
+static uint8_t tm_send_mailbox(struct token_manager *tm, uint8_t budget, uint8_t tok)
+{
+    uint8_t sent = 0;
+
+    for (int n = 0; n < CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS && sent < budget; n++) {
+        int i = (tm->mbox_next + n) % CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS;
+        size_t len;
+
+        /* The type byte is set when the slot is opened and never torn */
+        if (tm_frame_token(tm, tm->mbox[i].frame) != tok ||
+            !atomic_test_and_clear_bit(&tm->mbox_dirty, i) ||
+            !tm_mbox_read(&tm->mbox[i], tm->tx_frame, &len)) {
+            continue;
+        }
+
+        tm_stamp_tx(tm);
+        tm_hold_tx(tm, tm->tx_frame, len, NULL);
+        tm->mbox_next = (i + 1) % CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS;
+        sent++;
+    }
+
+    return sent;
+}
+
+/* Send queued frames granted by token tok, oldest first; the rest keep their place */
+static void tm_send_queued_frames(struct token_manager *tm, uint8_t budget, uint8_t tok)
+{
+    struct tm_mpsc_node **link = &tm->tx_pending;
+    struct tm_mpsc_node *prev = NULL;
+
+    tm_take_committed(tm);
+
+    /* The queue only drains here, so it peaks just before a hold */
+    tm->stats.tx_q_high_water = MAX(tm->stats.tx_q_high_water, tm->tx_pending_count);
+
+    for (uint8_t i = 0; i < budget && *link != NULL;) {
+        struct tm_mpsc_node *n = *link;
+        struct token_manager_tx_slot *slot = CONTAINER_OF(n, struct token_manager_tx_slot, node);
+        size_t len = tm_slot_frame_len(slot->frame);
+
+        if (tm_frame_token(tm, slot->frame) != tok) {
+            prev = n;
+            link = &n->next;
+            continue;
+        }
+
+        *link = n->next;
+        if (tm->tx_pending_tail == n) {
+            tm->tx_pending_tail = prev;
+        }
+        tm->tx_pending_count--;
+        i++;
+
+        /* Addressed frames do not come back to be timed */
+        if (slot->frame[0] == TM_DATA_DELIMITER) {
+            tm_stamp_tx(tm);
+        }
+        tm_hold_tx(tm, slot->frame, len, slot);
+    }
+}
+
+static void tm_forward_token(struct token_manager *tm)
+{
+    uint8_t frame[sizeof(tm->tx_token)];
+    uint8_t *token = tm->hold_mode == TM_HOLD_GATHER ? tm->tx_token : frame;
+    size_t len;
+
+    if (tm->telem_n > 0) {
+        len = tm_frame_encode_telem_token(token, sizeof(frame), tm->token_id, tm->agg, tm->agg_n,
+                                          tm->seen, tm->seen_n, tm->telem, tm->telem_n);
+    } else if (tm->seen_n > 0) {
+        len = tm_frame_encode_seen_token(token, sizeof(frame), tm->token_id, tm->agg, tm->agg_n,
+                                         tm->seen, tm->seen_n);
+    } else if (tm->agg_n > 0) {
+        len = tm_frame_encode_agg_token(token, sizeof(frame), tm->token_id, tm->agg, tm->agg_n);
+    } else {
+        len = tm_frame_encode_token(token, sizeof(frame), tm->token_id);
+    }
+    /* The token closes the hold's write */
+    tm_hold_tx(tm, token, len, NULL);
+    if (tm->clk_armed) {
+        /* It has left when the write completes, if it made it into a gather */
+        bool gathered = tm->hold_mode == TM_HOLD_GATHER && tm->tx_n_segs > 0;
+
+        atomic_set(&tm->clk_tx, gathered ? TM_CLK_TX_PENDING : TM_CLK_TX_NONE);
+        tm->clk_hand_us = tm_now(tm);
+        tm->clk_armed = false;
+    }
+    tm_hold_flush(tm);
+}
+
+static int32_t tm_agg_identity(uint8_t op)
+{
+    switch (op & ~TM_AGG_RESULT_VALID) {
+    case TM_AGG_MIN:
+        return INT32_MAX;
+    case TM_AGG_MAX:
+        return INT32_MIN;
+    default:
+        return 0;
+    }
+}
+
+static int32_t tm_agg_fold(uint8_t op, int32_t acc, int32_t value)
+{
+    switch (op & ~TM_AGG_RESULT_VALID) {
+    case TM_AGG_SUM:
+        return (int32_t)((uint32_t)acc + (uint32_t)value);
+    case TM_AGG_MIN:
+        return MIN(acc, value);
+    case TM_AGG_MAX:
+        return MAX(acc, value);
+    case TM_AGG_COUNT:
+        return (int32_t)((uint32_t)acc + 1);
+    default:
+        /* Operations we do not know are passed on untouched */
+        return acc;
+    }
+}
+
+/* Fields for a token created here, with no result yet */
+static void tm_agg_reset(struct token_manager *tm)
+{
+    tm->agg_n = tm->cfg.agg_fields;
+    for (uint8_t i = 0; i < tm->agg_n; i++) {
+        struct tm_agg_field f = {
+            .op = tm->cfg.agg_ops[i],
+            .acc = tm_agg_identity(tm->cfg.agg_ops[i]),
+        };
+
+        tm_frame_agg_field_put(tm->agg, i, &f);
+    }
+}
+
+/*
+ * Take the aggregation fields of an arriving token: the start node closes
+ * the rotation, turning each accumulator into a result, then every node
+ * picks up the results and folds in its own values.
+ */
+static void tm_agg_pass(struct token_manager *tm, const struct tm_frame *frame)
+{
+    bool rotate = tm->cfg.start_node;
+
+    tm->agg_n = frame->len;
+    if (frame->len > 0) {
+        memcpy(tm->agg, frame->payload, frame->len * TM_AGG_FIELD_LEN);
+    }
+    if (tm->cfg.start_node && tm->agg_n != tm->cfg.agg_fields) {
+        /* Created elsewhere, after a token loss: start over with our fields */
+        tm_agg_reset(tm);
+        rotate = false;
+    }
+
+    for (uint8_t i = 0; i < tm->agg_n; i++) {
+        struct tm_agg_field f;
+
+        tm_frame_agg_field_get(tm->agg, i, &f);
+        if (rotate) {
+            f.result = f.acc;
+            f.op |= TM_AGG_RESULT_VALID;
+            f.acc = tm_agg_identity(f.op);
+        }
+        if (f.op & TM_AGG_RESULT_VALID) {
+            atomic_set(&tm->agg_result[i], f.result);
+            atomic_set_bit(&tm->agg_valid, i);
+        }
+        if (atomic_test_bit(&tm->agg_set, i)) {
+            f.acc = tm_agg_fold(f.op, f.acc, (int32_t)atomic_get(&tm->agg_value[i]));
+        }
+        tm_frame_agg_field_put(tm->agg, i, &f);
+    }
+}
+
+/* Count an addressed frame from src taken off the ring here */
+static void tm_seen_note(struct token_manager *tm, uint8_t src)
+{
+    struct tm_seen_report *r = tm->seen_pending;
+    uint8_t i;
+
+    for (i = 0; i < tm->seen_pending_n; i++) {
+        if (r[i].src == src) {
+            break;
+        }
+    }
+    if (i == tm->seen_pending_n) {
+        if (i == ARRAY_SIZE(tm->seen_pending)) {
+            /* Reports are advisory; the frame itself was delivered */
+            return;
+        }
+        r[i] = (struct tm_seen_report){.src = src, .dst = tm->cfg.node_id};
+        tm->seen_pending_n++;
+    }
+    if (r[i].frames < UINT8_MAX) {
+        r[i].frames++;
+    }
+}
+
+/*
+ * Take the seen reports of an arriving token, or of none for a token made
+ * here: those for this node are handed to seen_cb, the rest go on with
+ * this node's own pending reports added while there is room.
+ */
+static void tm_seen_pass(struct token_manager *tm, const struct tm_frame *frame)
+{
+    uint8_t n_seen = frame != NULL ? frame->n_seen : 0;
+    uint8_t kept = 0;
+
+    tm->seen_n = 0;
+    for (uint8_t i = 0; i < n_seen; i++) {
+        struct tm_seen_report r;
+
+        tm_frame_seen_get(frame->seen, i, &r);
+        if (r.src != tm->cfg.node_id) {
+            tm_frame_seen_put(tm->seen, tm->seen_n++, &r);
+        } else if (tm->cfg.seen_cb != NULL) {
+            tm->cfg.seen_cb(tm, r.dst, r.frames, tm->cfg.user_data);
+        }
+    }
+
+    for (uint8_t i = 0; i < tm->seen_pending_n; i++) {
+        if (tm->seen_n < TM_SEEN_MAX) {
+            tm_frame_seen_put(tm->seen, tm->seen_n++, &tm->seen_pending[i]);
+        } else {
+            tm->seen_pending[kept++] = tm->seen_pending[i];
+        }
+    }
+    tm->seen_pending_n = kept;
+}
+
+/* Telemetry slots for a token 0 created here, every time unknown */
+static void tm_telem_reset(struct token_manager *tm)
+{
+    const struct tm_telem_slot unknown = {
+        .hold_us = TM_TELEM_UNKNOWN,
+        .fwd_us = TM_TELEM_UNKNOWN,
+    };
+
+    tm->telem_n = tm->cfg.telemetry_nodes;
+    for (uint8_t i = 0; i < tm->telem_n; i++) {
+        tm_frame_telem_put(tm->telem, i, &unknown);
+    }
+}
+
+/* The start node has the times of a full rotation: record them and start over */
+static void tm_telem_record(struct token_manager *tm)
+{
+#if TM_TELEM_HIST_NODES > 0
+    for (uint8_t i = 0; i < MIN(tm->telem_n, TM_TELEM_HIST_NODES); i++) {
+        struct tm_telem_slot slot;
+
+        tm_frame_telem_get(tm->telem, i, &slot);
+        if (slot.hold_us != TM_TELEM_UNKNOWN) {
+            tm_hist_record(&tm->telem_hist[i][TM_TELEM_HOLD], slot.hold_us);
+        }
+        if (slot.fwd_us != TM_TELEM_UNKNOWN) {
+            tm_hist_record(&tm->telem_hist[i][TM_TELEM_FORWARD], slot.fwd_us);
+        }
+    }
+#endif
+    tm_telem_reset(tm);
+}
+
+/* Take the telemetry trailer of an arriving token 0 */
+static void tm_telem_pass(struct token_manager *tm, const struct tm_frame *frame)
+{
+    tm->telem_n = frame->n_telem;
+    if (frame->n_telem > 0) {
+        memcpy(tm->telem, frame->telem, frame->n_telem * TM_TELEM_SLOT_LEN);
+    }
+    if (!tm->cfg.start_node) {
+        return;
+    }
+    if (tm->telem_n == tm->cfg.telemetry_nodes) {
+        tm_telem_record(tm);
+    } else {
+        /* Created elsewhere, after a token loss */
+        tm_telem_reset(tm);
+    }
+}
+
+/*
+ * Put this node's times in its telemetry slot: the hold begun at start,
+ * and the forwarding delay of our last pass if its departure was stamped
+ */
+static void tm_telem_stamp(struct token_manager *tm, uint32_t start)
+{
+    struct tm_telem_slot slot = {
+        .hold_us = MIN(tm_now(tm) - start, TM_TELEM_UNKNOWN - 1),
+        .fwd_us = TM_TELEM_UNKNOWN,
+    };
+
+    if (atomic_get(&tm->clk_tx) == TM_CLK_TX_DONE) {
+        slot.fwd_us = MIN(tm->clk_tx_us - tm->clk_hand_us, TM_TELEM_UNKNOWN - 1);
+    }
+    tm_frame_telem_put(tm->telem, tm->cfg.node_id, &slot);
+    tm->clk_armed = true;
+}
+
+static void tm_clock_arrival(struct token_manager *tm, uint32_t now);
+static void tm_clock_pass(struct token_manager *tm);
+
+/* TOKEN_RECEIVED -> DATA_TRANSMISSION -> TOKEN_FORWARDING -> IDLE */
+static void tm_hold_token(struct token_manager *tm, uint8_t tok)
+{
+    uint32_t start = tm_now(tm);
+    uint8_t budget = tm->cfg.max_frames_per_hold;
+
+    tm_set_state(tm, TM_STATE_DATA_TRANSMISSION);
+    tm_stamp_reset(tm);
+    tm_hold_begin(tm);
+    if (tok == 0) {
+        tm_send_diag_frames(tm);
+        tm_send_pdata(tm);
+    }
+    budget -= tm_send_mailbox(tm, budget, tok);
+    tm_send_queued_frames(tm, budget, tok);
+
+    tm_set_state(tm, TM_STATE_TOKEN_FORWARDING);
+    if (tok == 0 && tm->cfg.clock_sync) {
+        tm_clock_pass(tm);
+    }
+    if (tok == 0 && tm->cfg.node_id < tm->telem_n) {
+        tm_telem_stamp(tm, start);
+    }
+    tm_forward_token(tm);
+    tm_hist(tm, TM_HIST_HOLD, tm_now(tm) - start);
+
+    tm_set_state(tm, TM_STATE_IDLE);
+}
+
+/* A token, or in slotted mode slot 0, has come round; index 0 sets the rotation */
+static void tm_rotation(struct token_manager *tm, uint8_t tok, uint32_t now)
+{
+    struct token_manager_token *t = &tm->tokens[tok];
+
+    if (t->seen) {
+        uint32_t rotation = now - t->last_us;
+
+        if (tok == 0) {
+            tm->rotation_us = rotation;
+            tm->rotations++;
+        }
+        tm_hist(tm, TM_HIST_ROTATION, rotation);
+    }
+    t->seen = true;
+    t->last_us = now;
+}
+
+static void tm_handle_token(struct token_manager *tm, const struct tm_frame *frame)
+{
+    uint8_t token_id = frame->token_id;
+    uint8_t tok = tm_token_index(tm, token_id);
+    struct token_manager_token *t = &tm->tokens[tok];
+
+    uint32_t now = tm_now(tm);
+
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_TOKEN_RX, token_id);
+    tm_set_state(tm, TM_STATE_TOKEN_RECEIVED);
+
+    tm_rotation(tm, tok, now);
+    if (tok == 0 && tm->cfg.clock_sync) {
+        tm_clock_arrival(tm, now);
+    }
+
+    /*
+     * The start node opens a new circulation each time the token returns;
+     * stepping by the token count leaves the index alone
+     */
+    if (tm->cfg.start_tokens & BIT(tok)) {
+        token_id += tm->cfg.tokens;
+    }
+    tm->token_id = token_id;
+    t->id = token_id;
+
+    if (tok == 0) {
+        tm_agg_pass(tm, frame);
+        tm_telem_pass(tm, frame);
+    } else {
+        tm->agg_n = 0;
+        tm->telem_n = 0;
+    }
+    tm_seen_pass(tm, frame);
+
+    tm_hold_token(tm, tok);
+}
+
+#ifdef CONFIG_TOKEN_MANAGER_MAC_INSERTION
+static void tm_ins_hold(struct token_manager *tm, const uint8_t *raw, size_t len,
+                        uint32_t rx_us);
+#endif
+
+static void tm_forward_frame(struct token_manager *tm, const uint8_t *raw, size_t len,
+                             uint32_t rx_us)
+{
+#ifdef CONFIG_TOKEN_MANAGER_MAC_INSERTION
+    if (tm->cfg.mac == TM_MAC_INSERTION &&
+        (atomic_get(&tm->tx_gather_busy) || tm->ins_len[tm->ins_fill] > 0)) {
+        tm_ins_hold(tm, raw, len, rx_us);
+        return;
+    }
+#endif
+
+    int ret = tm_tx(tm, raw, len);
+    if (ret < 0) {
+        LOG_ERR("Forward TX failed: %d", ret);
+    } else {
+        tm->stats.frames_fwd++;
+    }
+    tm_hist(tm, TM_HIST_HOP_DELAY, tm_now(tm) - rx_us);
+}
+
+static int tm_rx_buf_alloc(struct token_manager *tm)
+{
+    for (int i = 0; i < CONFIG_TOKEN_MANAGER_RX_POOL_BUFFERS; i++) {
+        if (atomic_test_and_clear_bit(&tm->rx_free, i)) {
+            return i;
+        }
+    }
+
+    return -ENOMEM;
+}
+
+static bool tm_sub_match(const struct token_manager_sub *sub, const struct tm_frame *frame)
+{
+    if (sub->src != TM_SUB_ANY && sub->src != frame->node_id) {
+        return false;
+    }
+
+    return sub->type == TM_SUB_ANY || (frame->len > 0 && sub->type == frame->payload[0]);
+}
+
+/* Lend the frame's buffer to every matching subscriber */
+static void tm_deliver(struct token_manager *tm, const struct tm_frame *frame,
+                       const uint8_t *raw, size_t len)
+{
+    struct token_manager_rx_view view;
+    uint32_t type = frame->len > 0 ? BIT(frame->payload[0] % TM_SUB_FILTER_BITS) : 0;
+    uint32_t match = 0;
+    int lent;
+
+    if (!(tm->rx_src_filter & BIT(frame->node_id % TM_SUB_FILTER_BITS)) &&
+        !(tm->rx_type_filter & type)) {
+        return;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(tm->subs); i++) {
+        if ((tm->subs_used & BIT(i)) && tm_sub_match(&tm->subs[i], frame)) {
+            match |= BIT(i);
+        }
+    }
+    if (match == 0) {
+        return;
+    }
+
+    int next = tm_rx_buf_alloc(tm);
+    if (next < 0) {
+        tm->stats.buf_misses++;
+        return;
+    }
+
+    if (raw == tm->dec.buf) {
+        /* Keep the frame where it was assembled; the decoder moves on */
+        lent = tm->rx_cur;
+        tm->rx_cur = next;
+        tm->dec.buf = tm->rx_pool[next].frame;
+    } else {
+        lent = next;
+        memcpy(tm->rx_pool[lent].frame, raw, len);
+    }
+
+    /* Take every reference up front so an early release cannot recycle it */
+    atomic_set(&tm->rx_pool[lent].refs, POPCOUNT(match));
+
+    view.src = frame->node_id;
+    view.len = frame->len;
+    view.payload = tm->rx_pool[lent].frame + (frame->payload - raw);
+    view.buf = lent;
+
+    for (int i = 0; i < ARRAY_SIZE(tm->subs); i++) {
+        if (match & BIT(i)) {
+            tm->subs[i].cb(tm, &view, tm->subs[i].user_data);
+        }
+    }
+}
+
+static void tm_handle_data(struct token_manager *tm, const struct tm_frame *frame,
+                           const uint8_t *raw, size_t len, uint32_t rx_us)
+{
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_DATA_RX, (frame->node_id << 8) | frame->len);
+
+    if (frame->node_id == tm->cfg.node_id) {
+        /* Our own frame has travelled the full ring: strip it */
+        if (frame->dst == TM_BROADCAST) {
+            tm_stamp_return(tm);
+        } else {
+            LOG_DBG("Frame for node %u came back", frame->dst);
+        }
+        return;
+    }
+
+    if (frame->dst != TM_BROADCAST && frame->dst != tm->cfg.node_id) {
+        tm_forward_frame(tm, raw, len, rx_us);
+        return;
+    }
+
+    tm->stats.frames_rx++;
+    if (tm->cfg.rx_cb != NULL) {
+        tm->cfg.rx_cb(tm, frame->node_id, frame->payload, frame->len, tm->cfg.user_data);
+    }
+    tm_deliver(tm, frame, raw, len);
+
+    if (frame->dst == tm->cfg.node_id) {
+        /* Destination stripped: the rest of the ring never sees it */
+        tm_seen_note(tm, frame->node_id);
+        return;
+    }
+
+    tm_forward_frame(tm, raw, len, rx_us);
+}
+
+/* The oldest queued data frame, if any, left in the queue */
+static struct token_manager_tx_slot *tm_pending_head(struct token_manager *tm)
+{
+    tm_take_committed(tm);
+    tm->stats.tx_q_high_water = MAX(tm->stats.tx_q_high_water, tm->tx_pending_count);
+
+    if (tm->tx_pending == NULL) {
+        return NULL;
+    }
+
+    return CONTAINER_OF(tm->tx_pending, struct token_manager_tx_slot, node);
+}
+
+static void tm_pending_pop(struct token_manager *tm)
+{
+    struct tm_mpsc_node *n = tm->tx_pending;
+
+    tm->tx_pending = n->next;
+    if (tm->tx_pending_tail == n) {
+        tm->tx_pending_tail = NULL;
+    }
+    tm->tx_pending_count--;
+}
+
+/*
+ * Copy out the next updated mailbox slot, as a hold would send it, skipping
+ * values longer than max
+ */
+static bool tm_mbox_take(struct token_manager *tm, uint8_t *buf, size_t max)
+{
+    for (int n = 0; n < CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS; n++) {
+        int i = (tm->mbox_next + n) % CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS;
+        size_t len;
+
+        if (!atomic_test_and_clear_bit(&tm->mbox_dirty, i) ||
+            !tm_mbox_read(&tm->mbox[i], buf, &len)) {
+            continue;
+        }
+        tm->mbox_next = (i + 1) % CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS;
+        if (buf[2] <= max) {
+            return true;
+        }
+        LOG_DBG("Mailbox %d value too long for a slot", i);
+    }
+
+    return false;
+}
+
+/*
+ * Pass an empty slot on, filled if fill is set with an updated mailbox
+ * value or else our oldest queued frame
+ */
+static void tm_slot_send(struct token_manager *tm, uint8_t num, bool fill)
+{
+    uint8_t mbox[sizeof(tm->mbox[0].frame)];
+    struct token_manager_tx_slot *slot = NULL;
+    const uint8_t *data = NULL;
+    uint8_t ctrl = num;
+    uint8_t src = 0;
+    uint8_t dst = 0;
+    size_t n = 0;
+    size_t len;
+
+    if (fill && tm_mbox_take(tm, mbox, CONFIG_TOKEN_MANAGER_SLOT_SIZE)) {
+        data = mbox;
+    } else if (fill && (slot = tm_pending_head(tm)) != NULL) {
+        tm_pending_pop(tm);
+        data = slot->frame;
+    }
+
+    if (data != NULL) {
+        n = data[2];
+        memcpy(&tm->tx_frame[TM_SLOT_HDR_LEN], &data[TM_DATA_HDR_LEN], n);
+        ctrl |= TM_SLOT_FULL;
+        src = tm->cfg.node_id;
+        dst = data[0] == TM_ADDR_DELIMITER ? data[TM_DATA_HDR_LEN + n] : TM_BROADCAST;
+    }
+    if (slot != NULL) {
+        atomic_set_bit(tm->tx_free, slot - tm->tx_slots);
+    }
+
+    len = tm_frame_finish_slot(tm->tx_frame, ctrl, src, dst, n, CONFIG_TOKEN_MANAGER_SLOT_SIZE);
+    if (tm_tx(tm, tm->tx_frame, len) < 0) {
+        LOG_ERR("Slot %u TX failed", num);
+    } else if (data != NULL) {
+        tm->stats.frames_tx++;
+    }
+}
+
+/* The monitor's fresh set of empty slots, numbered from 0 */
+static void tm_slots_create(struct token_manager *tm)
+{
+    for (uint8_t i = 0; i < tm->cfg.slots; i++) {
+        tm_slot_send(tm, i, false);
+    }
+}
+
+/*
+ * Slotted mode: a slot goes straight on, having delivered or released what
+ * it carried, and filled if it is empty and this node may use it.
+ */
+static void tm_handle_slot(struct token_manager *tm, const struct tm_frame *frame,
+                           const uint8_t *raw, size_t len, uint32_t rx_us)
+{
+    uint8_t num = frame->ctrl & TM_SLOT_NUM_MASK;
+    uint8_t ctrl = frame->ctrl;
+
+    tm->slot_rx_us = rx_us;
+    if (num == 0) {
+        tm_rotation(tm, 0, rx_us);
+    }
+
+    if (!(ctrl & TM_SLOT_FULL)) {
+        tm_slot_send(tm, num, true);
+        return;
+    }
+
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_DATA_RX, (frame->node_id << 8) | frame->len);
+
+    if (frame->node_id == tm->cfg.node_id) {
+        /* Back at its source: released, and left for the next node */
+        tm_slot_send(tm, num, false);
+        return;
+    }
+    if (tm->cfg.start_node && (ctrl & TM_SLOT_MONITOR)) {
+        /* Round twice, so its source has gone */
+        LOG_DBG("Slot %u from node %u orphaned", num, frame->node_id);
+        tm_slot_send(tm, num, true);
+        return;
+    }
+
+    if (frame->dst == TM_BROADCAST || frame->dst == tm->cfg.node_id) {
+        tm->stats.frames_rx++;
+        if (tm->cfg.rx_cb != NULL) {
+            tm->cfg.rx_cb(tm, frame->node_id, frame->payload, frame->len, tm->cfg.user_data);
+        }
+        tm_deliver(tm, frame, raw, len);
+    }
+    if (frame->dst == tm->cfg.node_id) {
+        /* Destination release: free for this node or the ones after it */
+        tm_slot_send(tm, num, true);
+        return;
+    }
+
+    if (!tm->cfg.start_node) {
+        tm_forward_frame(tm, raw, len, rx_us);
+        return;
+    }
+
+    /* The monitor marks full slots going past it */
+    memcpy(tm->tx_frame, raw, len);
+    tm_frame_finish_slot(tm->tx_frame, ctrl | TM_SLOT_MONITOR, frame->node_id, frame->dst,
+                         frame->len, CONFIG_TOKEN_MANAGER_SLOT_SIZE);
+    tm_forward_frame(tm, tm->tx_frame, len, rx_us);
+}
+
+#ifdef CONFIG_TOKEN_MANAGER_MAC_INSERTION
+/* Insertion mode: keep an upstream frame until the line is ours again */
+static void tm_ins_hold(struct token_manager *tm, const uint8_t *raw, size_t len,
+                        uint32_t rx_us)
+{
+    uint8_t fill = tm->ins_fill;
+
+    if (tm->ins_len[fill] + len > sizeof(tm->ins_buf[fill])) {
+        LOG_DBG("Insertion buffer full, frame dropped");
+        tm->stats.buf_misses++;
+        return;
+    }
+
+    if (tm->ins_frames[fill] == 0) {
+        tm->ins_rx_us = rx_us;
+    }
+    memcpy(&tm->ins_buf[fill][tm->ins_len[fill]], raw, len);
+    tm->ins_len[fill] += len;
+    tm->ins_frames[fill]++;
+}
+
+/* Insertion mode: one in-place write, reported by token_manager_tx_done() */
+static int tm_ins_write(struct token_manager *tm, const uint8_t *buf, size_t len)
+{
+    int ret;
+
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_TX, len);
+    tm->tx_segs[0] = (struct token_manager_tx_seg){buf, len};
+    atomic_set(&tm->tx_gather_busy, 1);
+    ret = tm->cfg.port.tx_gather(tm->cfg.port.ctx, tm->tx_segs, 1);
+    if (ret < 0) {
+        tm_release_inflight(tm);
+        atomic_clear(&tm->tx_gather_busy);
+    }
+
+    return ret;
+}
+
+/*
+ * Insertion mode: once the last transmission has ended, drain what arrived
+ * during it, in place while the other buffer fills, or with nothing held
+ * send a frame of our own
+ */
+static void tm_ins_poll(struct token_manager *tm)
+{
+    struct token_manager_tx_slot *slot;
+    uint8_t fill = tm->ins_fill;
+    const uint8_t *buf;
+    size_t len;
+    int ret;
+
+    if (atomic_get(&tm->tx_gather_busy)) {
+        return;
+    }
+
+    if (tm->ins_len[fill] > 0) {
+        /* The other buffer has gone out and takes the next arrivals */
+        tm->ins_fill = !fill;
+        tm->ins_len[!fill] = 0;
+        tm->ins_frames[!fill] = 0;
+
+        ret = tm_ins_write(tm, tm->ins_buf[fill], tm->ins_len[fill]);
+        if (ret < 0) {
+            LOG_ERR("Insertion buffer TX failed: %d", ret);
+        } else {
+            tm->stats.frames_fwd += tm->ins_frames[fill];
+        }
+        /* Sampled for the frame that waited longest */
+        tm_hist(tm, TM_HIST_HOP_DELAY, tm_now(tm) - tm->ins_rx_us);
+        return;
+    }
+
+    /* Nothing references tx_frame between transmissions in this mode */
+    if (tm_mbox_take(tm, tm->tx_frame, TM_MAX_PAYLOAD)) {
+        buf = tm->tx_frame;
+    } else if ((slot = tm_pending_head(tm)) != NULL) {
+        tm_pending_pop(tm);
+        slot->node.next = NULL;
+        tm->tx_inflight = &slot->node;
+        buf = slot->frame;
+    } else {
+        return;
+    }
+
+    len = tm_slot_frame_len(buf);
+    ret = tm_ins_write(tm, buf, len);
+    if (ret < 0) {
+        LOG_ERR("Insertion TX failed: %d", ret);
+    } else {
+        tm->stats.frames_tx++;
+    }
+}
+#endif
+
+/* The master's clock at our time now, extrapolated from the last sync */
+static uint32_t tm_ring_clock(struct token_manager *tm, uint32_t now)
+{
+    int64_t since = (int32_t)(now - tm->sync_rx_us);
+
+    return now + tm->sync_offset_us + (int32_t)(since * tm->drift_ppb / NSEC_PER_SEC);
+}
+
+/*
+ * Master: start a cycle. Origin is when it was due to start; the delay
+ * before it actually went out is the master's own share of the correction.
+ */
+static void tm_sync_send(struct token_manager *tm, uint32_t now)
+{
+    struct tm_sync sync = {
+        .hops = 1,
+        .seq = tm->clk_tx_seq++,
+        .origin_us = tm->sync_next_us,
+        .correction_us = now - tm->sync_next_us,
+        .hop_us = tm->sync_hop_us,
+    };
+    size_t len = tm_frame_encode_sync(tm->tx_frame, sizeof(tm->tx_frame), &sync);
+
+    if (tm_tx(tm, tm->tx_frame, len) < 0) {
+        LOG_ERR("Sync TX failed");
+    }
+}
+
+/* TDMA mode: one slot, sent as a token hold would be */
+static void tm_tdma_slot(struct token_manager *tm, uint32_t now)
+{
+    uint8_t budget = tm->cfg.max_frames_per_hold;
+
+    tm_rotation(tm, 0, now);
+
+    tm_set_state(tm, TM_STATE_DATA_TRANSMISSION);
+    tm_stamp_reset(tm);
+    tm_hold_begin(tm);
+    tm_send_diag_frames(tm);
+    budget -= tm_send_mailbox(tm, budget, 0);
+    tm_send_queued_frames(tm, budget, 0);
+    tm_hold_flush(tm);
+    tm_hist(tm, TM_HIST_HOLD, tm_now(tm) - now);
+
+    tm_set_state(tm, TM_STATE_IDLE);
+}
+
+/* Take the master's clock as master_us at our time rx_us */
+static void tm_clock_sync(struct token_manager *tm, uint32_t master_us, uint32_t rx_us)
+{
+    int32_t offset = (int32_t)(master_us - rx_us);
+
+    /* Odd while the clock is being updated; see token_manager_ring_time() */
+    atomic_inc(&tm->clock_seq);
+
+    if (tm->synced) {
+        int32_t since = (int32_t)(rx_us - tm->sync_rx_us);
+
+        /* Drift is the offset's slope, smoothed over about eight syncs */
+        if (since > 0) {
+            int32_t ppb = (int32_t)((int64_t)(offset - tm->sync_offset_us) * NSEC_PER_SEC / since);
+
+            tm->drift_ppb += (ppb - tm->drift_ppb) / 8;
+        }
+    } else {
+        LOG_INF("Synchronised to the time master, offset %d us", offset);
+        tm->synced = true;
+    }
+
+    tm->sync_offset_us = offset;
+    tm->sync_rx_us = rx_us;
+
+    atomic_inc(&tm->clock_seq);
+}
+
+/* TDMA mode: the master's clock read master_us at our time rx_us, in a cycle begun at origin */
+static void tm_tdma_sync(struct token_manager *tm, const struct tm_sync *sync, uint32_t master_us,
+                         uint32_t rx_us)
+{
+    bool synced = tm->synced;
+
+    tm_clock_sync(tm, master_us, rx_us);
+    if (!synced) {
+        /* Count slots on from the cycle's start */
+        tm->tdma_next_us = sync->origin_us + tm->cfg.tdma_offset_us;
+        while ((int32_t)(master_us - tm->tdma_next_us) > 0) {
+            tm->tdma_next_us += tm->cfg.tdma_cycle_us;
+        }
+    }
+}
+
+static void tm_handle_sync(struct token_manager *tm, const struct tm_frame *frame, uint32_t rx_us)
+{
+    struct tm_sync sync = frame->sync;
+    size_t len;
+
+    if (tm->cfg.start_node) {
+        /* Back at the master: the rest of the trip, past every node's delay, is the links' */
+        uint32_t links = rx_us - sync.origin_us - sync.correction_us;
+
+        tm->sync_hop_us = MIN(links / MAX(sync.hops, 1), TM_SYNC_HOP_UNKNOWN - 1);
+        return;
+    }
+
+    /* The master's first sync frames come before it knows the link delay */
+    if (sync.hop_us != TM_SYNC_HOP_UNKNOWN) {
+        tm_tdma_sync(tm, &sync,
+                     sync.origin_us + sync.correction_us + sync.hops * sync.hop_us, rx_us);
+    }
+
+    sync.hops++;
+    sync.correction_us += tm_now(tm) - rx_us;
+    len = tm_frame_encode_sync(tm->tx_frame, sizeof(tm->tx_frame), &sync);
+    tm_forward_frame(tm, tm->tx_frame, len, rx_us);
+}
+
+static void tm_tdma_tick(struct token_manager *tm, uint32_t now, uint32_t timeout)
+{
+    uint32_t master;
+
+    if (tm->cfg.start_node) {
+        if ((int32_t)(now - tm->sync_next_us) >= 0) {
+            tm_sync_send(tm, now);
+            /* Cycles missed altogether are not made up */
+            do {
+                tm->sync_next_us += tm->cfg.tdma_cycle_us;
+            } while ((int32_t)(now - tm->sync_next_us) >= 0);
+        }
+    } else if (tm->synced && (now - tm->sync_rx_us) >= timeout) {
+        LOG_WRN("No sync frame for %u us, stopping", now - tm->sync_rx_us);
+        tm->stats.token_timeouts++;
+        atomic_inc(&tm->clock_seq);
+        tm->synced = false;
+        tm->drift_ppb = 0;
+        atomic_inc(&tm->clock_seq);
+    }
+
+    if (!tm->synced) {
+        return;
+    }
+
+    master = tm_ring_clock(tm, now);
+    if ((int32_t)(master - tm->tdma_next_us) >= 0) {
+        do {
+            tm->tdma_next_us += tm->cfg.tdma_cycle_us;
+        } while ((int32_t)(master - tm->tdma_next_us) >= 0);
+        tm_tdma_slot(tm, now);
+    }
+}
+
+/* Clock sync: token 0 has arrived */
+static void tm_clock_arrival(struct token_manager *tm, uint32_t now)
+{
+    tm->clk_rx_us = now;
+    if (tm->cfg.start_node) {
+        /* Back from the rotation we last sent it on */
+        tm->clk_rx_seq = tm->clk_tx_seq;
+        tm->clk_rx_valid = true;
+    } else {
+        /* The sync frame ahead of it carried the rotation before */
+        tm->clk_rx_seq = tm->clk_sync.seq + 1;
+        tm->clk_rx_valid = tm->clk_held;
+    }
+}
+
+/* Clock sync: send the sync frame ahead of token 0, whose departure is then stamped */
+static void tm_clock_pass(struct token_manager *tm)
+{
+    uint8_t frame[TM_SYNC_FRAME_LEN];
+    /* Only a gather hold stamps the departure, so only it needs the frame kept */
+    uint8_t *buf = tm->hold_mode == TM_HOLD_GATHER ? tm->tx_clk : frame;
+    size_t len;
+
+    if (tm->cfg.start_node) {
+        /* The last rotation's times, if we know when it began */
+        if (atomic_get(&tm->clk_tx) == TM_CLK_TX_DONE) {
+            tm->clk_sync = (struct tm_sync){
+                .hops = 1,
+                .seq = tm->clk_tx_seq,
+                .origin_us = tm->clk_tx_us,
+                .hop_us = tm->sync_hop_us,
+            };
+            tm->clk_held = true;
+        }
+        tm->clk_tx_seq++;
+        tm->clk_armed = true;
+    } else {
+        tm->clk_tx_seq = tm->clk_rx_seq;
+        tm->clk_armed = tm->clk_rx_valid;
+    }
+
+    if (tm->clk_held) {
+        len = tm_frame_encode_sync(buf, sizeof(frame), &tm->clk_sync);
+        tm_hold_tx(tm, buf, len, NULL);
+        tm->clk_held = false;
+    }
+}
+
+/*
+ * Clock sync: the times of token 0's last rotation, just ahead of the
+ * token. Our own arrival and departure on it complete them up to here.
+ */
+static void tm_handle_clock_sync(struct token_manager *tm, const struct tm_frame *frame)
+{
+    struct tm_sync sync = frame->sync;
+    bool arrived = tm->clk_rx_valid && tm->clk_rx_seq == sync.seq;
+    bool left = tm->clk_tx_seq == sync.seq && atomic_get(&tm->clk_tx) == TM_CLK_TX_DONE;
+
+    if (sync.correction_us == TM_SYNC_NO_CORRECTION) {
+        arrived = false;
+    }
+
+    if (tm->cfg.start_node) {
+        /* Back round: the rest of the trip, past every node's delay, is the links' */
+        if (arrived) {
+            int32_t links = (int32_t)(tm->clk_rx_us - sync.origin_us - sync.correction_us);
+
+            tm->sync_hop_us = CLAMP(links / MAX(sync.hops, 1), 0, TM_SYNC_HOP_UNKNOWN - 1);
+        }
+        return;
+    }
+
+    if (arrived && sync.hop_us != TM_SYNC_HOP_UNKNOWN) {
+        tm_clock_sync(tm, sync.origin_us + sync.correction_us + sync.hops * sync.hop_us,
+                      tm->clk_rx_us);
+    }
+
+    sync.hops++;
+    if (arrived && left) {
+        sync.correction_us += tm->clk_tx_us - tm->clk_rx_us;
+    } else {
+        sync.correction_us = TM_SYNC_NO_CORRECTION;
+    }
+    tm->clk_sync = sync;
+    tm->clk_held = true;
+}
+
+static size_t tm_pd_feed(struct token_manager *tm, const uint8_t *data, size_t len);
+
+static void tm_handle_pdata(struct token_manager *tm, const struct tm_frame *frame,
+                            const uint8_t *raw, size_t len)
+{
+    if (frame->node_id != tm->cfg.node_id) {
+        /* Handed in whole rather than as received */
+        if (tm_pd_hdr_valid(tm, raw)) {
+            tm_pd_feed(tm, raw, len);
+        }
+        return;
+    }
+
+    /* Our own datagram has been round the ring: strip it */
+    if (tm->cfg.pd_done_cb != NULL) {
+        tm->cfg.pd_done_cb(tm, frame->payload, frame->len, frame->wkc, tm->cfg.user_data);
+    }
+}
+
+static void tm_handle_diag(struct token_manager *tm, const struct tm_frame *frame,
+                           const uint8_t *raw, size_t len, uint32_t rx_us)
+{
+    /* Diagnostic frames are source stripped like data frames */
+    if (frame->node_id == tm->cfg.node_id) {
+        /* A collect snapshot is complete once back at its requester */
+        if (frame->kind == TM_DIAG_COLLECT && tm->cfg.diag_cb != NULL) {
+            tm->cfg.diag_cb(tm, frame->node_id, TM_DIAG_COLLECT_RESPONSE, frame->payload,
+                            frame->len, tm->cfg.user_data);
+        }
+        return;
+    }
+
+    if (frame->kind == TM_DIAG_COLLECT) {
+        /* Grown in tx_frame, which nothing references between holds */
+        memcpy(tm->tx_frame, raw, len);
+        len = tm_collect_append(tm, frame->node_id, frame->dst, frame->len);
+        tm_forward_frame(tm, tm->tx_frame, len, rx_us);
+        return;
+    }
+
+    if (frame->dst == tm->cfg.node_id) {
+        if (frame->kind & TM_DIAG_RESPONSE_FLAG) {
+            if (tm->cfg.diag_cb != NULL) {
+                tm->cfg.diag_cb(tm, frame->node_id, frame->kind, frame->payload, frame->len,
+                                tm->cfg.user_data);
+            }
+        } else {
+            tm_diag_handle_request(tm, frame->node_id, frame->kind, frame->payload, frame->len);
+        }
+    }
+
+    tm_forward_frame(tm, raw, len, rx_us);
+}
+
+int token_manager_init(struct token_manager *tm, const struct token_manager_config *cfg)
+{
+    uint32_t now;
+
+    if (cfg->port.tx == NULL || cfg->port.now_us == NULL || cfg->node_id == TM_BROADCAST ||
+        cfg->pd_len > CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN || cfg->agg_fields > TM_AGG_MAX_FIELDS ||
+        cfg->tokens > TM_MAX_TOKENS || (cfg->tokens & (cfg->tokens - 1)) != 0 ||
+        cfg->mac > TM_MAC_TDMA || cfg->slots > TM_MAX_SLOTS ||
+        (cfg->mac != TM_MAC_TOKEN && cfg->tokens > 1) ||
+        (cfg->mac == TM_MAC_INSERTION &&
+         (!IS_ENABLED(CONFIG_TOKEN_MANAGER_MAC_INSERTION) || cfg->port.tx_gather == NULL)) ||
+        (cfg->clock_sync && (cfg->mac != TM_MAC_TOKEN || cfg->port.tx_gather == NULL)) ||
+        cfg->telemetry_nodes > TM_TELEM_MAX_NODES ||
+        (cfg->mac != TM_MAC_TOKEN && cfg->telemetry_nodes > 0) ||
+        (cfg->mac == TM_MAC_TDMA &&
+         (cfg->tdma_cycle_us == 0 || cfg->tdma_offset_us >= cfg->tdma_cycle_us ||
+          cfg->tdma_cycle_us > INT32_MAX))) {
+        return -EINVAL;
+    }
+
+    memset(tm, 0, sizeof(*tm));
+    tm->cfg = *cfg;
+
+    if (tm->cfg.token_timeout_us == 0) {
+        tm->cfg.token_timeout_us = CONFIG_TOKEN_MANAGER_TOKEN_TIMEOUT_MS * USEC_PER_MSEC;
+    }
+    if (tm->cfg.regen_stagger_us == 0) {
+        tm->cfg.regen_stagger_us = CONFIG_TOKEN_MANAGER_REGEN_STAGGER_MS * USEC_PER_MSEC;
+    }
+    if (tm->cfg.max_frames_per_hold == 0) {
+        tm->cfg.max_frames_per_hold = CONFIG_TOKEN_MANAGER_MAX_FRAMES_PER_HOLD;
+    }
+    if (tm->cfg.tokens == 0) {
+        tm->cfg.tokens = 1;
+    }
+    if (tm->cfg.slots == 0) {
+        tm->cfg.slots = 1;
+    }
+    tm->cfg.start_tokens &= BIT_MASK(tm->cfg.tokens);
+    if (tm->cfg.start_node) {
+        tm->cfg.start_tokens |= BIT(0);
+    }
+
+    for (int i = 0; i < CONFIG_TOKEN_MANAGER_TX_QUEUE_DEPTH; i++) {
+        atomic_set_bit(tm->tx_free, i);
+    }
+    tm_mpsc_init(&tm->tx_q);
+    k_msgq_init(&tm->diag_q, tm->diag_q_buf, sizeof(struct token_manager_diag_msg),
+                CONFIG_TOKEN_MANAGER_DIAG_QUEUE_DEPTH);
+#ifdef CONFIG_TOKEN_MANAGER_HISTOGRAMS
+    for (int i = 0; i < TM_HIST_COUNT; i++) {
+        tm_hist_reset(&tm->hist[i]);
+    }
+#if TM_TELEM_HIST_NODES > 0
+    for (int i = 0; i < TM_TELEM_HIST_NODES; i++) {
+        for (int id = 0; id < TM_TELEM_COUNT; id++) {
+            tm_hist_reset(&tm->telem_hist[i][id]);
+        }
+    }
+#endif
+#endif
+    /* Buffer 0 starts out with the decoder, the rest are free */
+    atomic_set(&tm->rx_free, GENMASK(CONFIG_TOKEN_MANAGER_RX_POOL_BUFFERS - 1, 1));
+    tm->rx_cur = 0;
+    tm->dec.buf = tm->rx_pool[0].frame;
+    tm_frame_decoder_reset(&tm->dec);
+    tm->dec.cut_through = TM_PDATA_DELIMITER;
+    tm_frame_encode_token(tm->tx_fast, sizeof(tm->tx_fast), 0);
+
+    tm_set_state(tm, TM_STATE_IDLE);
+    now = tm_now(tm);
+    tm->sync_hop_us = TM_SYNC_HOP_UNKNOWN;
+    /* The master's clock is the ring's, so it is synchronised from the start */
+    tm->synced = tm->cfg.start_node && (tm->cfg.mac == TM_MAC_TDMA || tm->cfg.clock_sync);
+
+    if (tm->cfg.mac == TM_MAC_SLOTTED) {
+        tm->dec.slot_size = CONFIG_TOKEN_MANAGER_SLOT_SIZE;
+        tm->slot_rx_us = now;
+        if (tm->cfg.start_node) {
+            LOG_INF("Node %u starting %u slots", tm->cfg.node_id, tm->cfg.slots);
+            tm_slots_create(tm);
+        }
+        return 0;
+    }
+    if (tm->cfg.mac == TM_MAC_INSERTION) {
+        return 0;
+    }
+    if (tm->cfg.mac == TM_MAC_TDMA) {
+        if (tm->cfg.start_node) {
+            LOG_INF("Node %u starting %u us TDMA cycles", tm->cfg.node_id,
+                    tm->cfg.tdma_cycle_us);
+            tm->sync_next_us = now;
+            tm->tdma_next_us = now + tm->cfg.tdma_offset_us;
+            tm_tdma_tick(tm, now, 0);
+        }
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < tm->cfg.tokens; i++) {
+        tm->tokens[i].id = i;
+        tm->tokens[i].last_us = now;
+    }
+
+    for (uint8_t i = 0; i < tm->cfg.tokens; i++) {
+        if (!(tm->cfg.start_tokens & BIT(i))) {
+            continue;
+        }
+        LOG_INF("Node %u starting token %u rotation", tm->cfg.node_id, i);
+        tm->tokens[i].seen = true;
+        tm->token_id = i;
+        if (i == 0) {
+            tm_agg_reset(tm);
+            tm_telem_reset(tm);
+        } else {
+            tm->agg_n = 0;
+            tm->telem_n = 0;
+        }
+        tm->seen_n = 0;
+        tm_forward_token(tm);
+    }
+
+    return 0;
+}
+
+static void tm_frame_ready(const uint8_t *frame, size_t len, void *user_data)
+{
+    (void)token_manager_process_frame(user_data, frame, len);
+}
+
+/* Pass bytes of a process data frame on, carrying the outgoing CRC over them */
+static void tm_pd_out(struct token_manager *tm, const uint8_t *buf, size_t len)
+{
+    struct token_manager_pd_rx *pd = &tm->pd_rx;
+
+    pd->crc_out = tm_frame_crc_update(pd->crc_out, buf, len);
+    if (tm_tx(tm, buf, len) < 0) {
+        pd->tx_failed = true;
+    }
+}
+
+/* The header is in: strip our own frame, or start passing it on */
+static void tm_pd_begin(struct token_manager *tm)
+{
+    struct token_manager_pd_rx *pd = &tm->pd_rx;
+
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_DATA_RX, (pd->hdr[1] << 8) | pd->hdr[3]);
+
+    pd->own = pd->hdr[1] == tm->cfg.node_id;
+    /* Round twice, so its source has gone, or was never on the ring */
+    pd->strip = !pd->own && tm->cfg.start_node && (pd->hdr[2] & TM_PDATA_MONITOR);
+    if (pd->own || pd->strip) {
+        memcpy(tm->dec.buf, pd->hdr, TM_PDATA_HDR_LEN);
+        return;
+    }
+
+    pd->crc_in = tm_frame_crc_update(TM_CRC_INIT, pd->hdr, TM_PDATA_HDR_LEN);
+    pd->crc_out = TM_CRC_INIT;
+    pd->tx_failed = false;
+    pd->slot_used = tm_pd_has_slot(tm, pd->hdr[3]);
+    if (pd->slot_used) {
+        pd->hdr[2] = (pd->hdr[2] & TM_PDATA_MONITOR) | ((pd->hdr[2] + 1) & TM_PDATA_WKC_MASK);
+    }
+    if (tm->cfg.start_node) {
+        /* The monitor marks frames going past it */
+        pd->hdr[2] |= TM_PDATA_MONITOR;
+    }
+    tm_pd_out(tm, pd->hdr, TM_PDATA_HDR_LEN);
+}
+
+/*
+ * Datagram bytes: passed straight on, except for our slot, which is held
+ * back until it is complete and then exchanged. Returns the bytes used.
+ */
+static size_t tm_pd_datagram(struct token_manager *tm, const uint8_t *data, size_t len)
+{
+    struct token_manager_pd_rx *pd = &tm->pd_rx;
+    const struct token_manager_config *cfg = &tm->cfg;
+    size_t off = pd->pos - TM_PDATA_HDR_LEN;
+    size_t end = pd->hdr[3];
+    size_t n;
+
+    if (pd->slot_used && off >= cfg->pd_offset) {
+        size_t at = off - cfg->pd_offset;
+
+        if (at < cfg->pd_len) {
+            n = MIN(len, cfg->pd_len - at);
+            memcpy(&pd->slot[at], data, n);
+            pd->crc_in = tm_frame_crc_update(pd->crc_in, data, n);
+            if (at + n == cfg->pd_len) {
+                cfg->pd_cb(tm, pd->slot, cfg->pd_len, cfg->user_data);
+                tm_pd_out(tm, pd->slot, cfg->pd_len);
+            }
+            return n;
+        }
+    } else if (pd->slot_used) {
+        end = cfg->pd_offset;
+    }
+
+    n = MIN(len, end - off);
+    pd->crc_in = tm_frame_crc_update(pd->crc_in, data, n);
+    tm_pd_out(tm, data, n);
+
+    return n;
+}
+
+static void tm_pd_end(struct token_manager *tm)
+{
+    struct token_manager_pd_rx *pd = &tm->pd_rx;
+    uint16_t crc = pd->crc_out;
+    bool bad;
+
+    if (pd->own) {
+        (void)token_manager_process_frame(tm, tm->dec.buf, pd->pos);
+        return;
+    }
+    if (pd->strip) {
+        struct tm_frame f;
+        int ret = tm_frame_decode(tm->dec.buf, pd->pos, &f);
+
+        TM_CAPTURE(tm->cfg.node_id, tm->dec.buf, pd->pos, ret);
+        LOG_WRN("Dropped process data frame from node %u on its second pass (%d)", pd->hdr[1],
+                ret);
+        return;
+    }
+
+    bad = sys_get_be16(pd->crc) != pd->crc_in;
+    TM_CAPTURE(tm->cfg.node_id, pd->cap, pd->pos, bad ? -EBADMSG : 0);
+    if (bad) {
+        /*
+         * Mostly gone already. Every node after us finds the CRC bad too
+         * and passes it on likewise, until its source, or the start node
+         * on its second pass, takes it off the ring.
+         */
+        crc = ~crc;
+        tm->stats.crc_errors++;
+        TM_TRACE(tm->cfg.node_id, TM_TRACE_FRAME_DROP, EBADMSG);
+        LOG_WRN("Passed on corrupt process data frame");
+    }
+
+    sys_put_be16(crc, pd->crc);
+    if (pd->tx_failed || tm_tx(tm, pd->crc, TM_CRC_LEN) < 0) {
+        LOG_ERR("Process data forward failed");
+    } else {
+        tm->stats.frames_fwd++;
+    }
+
+    /* What pd_cb took from the frame only counts now */
+    if (pd->slot_used && tm->cfg.pd_end_cb != NULL) {
+        tm->cfg.pd_end_cb(tm, !bad, tm->cfg.user_data);
+    }
+}
+
+/*
+ * The header is line noise: hunt through its last bytes with the decoder.
+ * One of them may start another process data frame, kept as its header.
+ */
+static void tm_pd_resync(struct token_manager *tm)
+{
+    struct token_manager_pd_rx *pd = &tm->pd_rx;
+    uint8_t rest[TM_PDATA_HDR_LEN - 1];
+    size_t n;
+
+    memcpy(rest, &pd->hdr[1], sizeof(rest));
+    n = tm_frame_decoder_feed(&tm->dec, rest, sizeof(rest), tm_frame_ready, tm);
+    pd->pos = sizeof(rest) - n;
+    memcpy(pd->hdr, &rest[n], pd->pos);
+#ifdef CONFIG_TOKEN_MANAGER_CAPTURE
+    memcpy(pd->cap, pd->hdr, pd->pos);
+#endif
+}
+
+/*
+ * Handle a process data frame as its bytes arrive rather than once it is
+ * complete, so it leaves for the next node while still coming in. Returns
+ * the bytes consumed, up to the end of the frame.
+ */
+static size_t tm_pd_feed(struct token_manager *tm, const uint8_t *data, size_t len)
+{
+    struct token_manager_pd_rx *pd = &tm->pd_rx;
+    size_t i = 0;
+
+    while (i < len) {
+        size_t body = TM_PDATA_HDR_LEN + pd->hdr[3];
+        size_t n;
+
+        if (pd->pos < TM_PDATA_HDR_LEN) {
+            n = MIN(len - i, TM_PDATA_HDR_LEN - pd->pos);
+            memcpy(&pd->hdr[pd->pos], &data[i], n);
+            if (pd->pos + n == TM_PDATA_HDR_LEN) {
+                if (!tm_pd_hdr_valid(tm, pd->hdr)) {
+                    tm_pd_resync(tm);
+                    return i + n;
+                }
+                tm_pd_begin(tm);
+            }
+        } else if (pd->own || pd->strip) {
+            n = MIN(len - i, body + TM_CRC_LEN - pd->pos);
+            memcpy(&tm->dec.buf[pd->pos], &data[i], n);
+        } else if (pd->pos < body) {
+            n = tm_pd_datagram(tm, &data[i], len - i);
+        } else {
+            n = MIN(len - i, body + TM_CRC_LEN - pd->pos);
+            memcpy(&pd->crc[pd->pos - body], &data[i], n);
+        }
+#ifdef CONFIG_TOKEN_MANAGER_CAPTURE
+        memcpy(&pd->cap[pd->pos], &data[i], n);
+#endif
+
+        i += n;
+        pd->pos += n;
+
+        /* A frame is at least a header and a CRC, so a partial header never ends here */
+        if (pd->pos == TM_PDATA_FRAME_LEN(pd->hdr[3])) {
+            tm_pd_end(tm);
+            pd->pos = 0;
+            break;
+        }
+    }
+
+    return i;
+}
+
+static void tm_rx_feed(struct token_manager *tm, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        size_t n;
+
+        /* The decoder stops in front of process data frames and leaves them to us */
+        if (tm->pd_rx.pos == 0 && (tm->dec.pos > 0 || data[0] != TM_PDATA_DELIMITER)) {
+            n = tm_frame_decoder_feed(&tm->dec, data, len, tm_frame_ready, tm);
+        } else {
+            n = tm_pd_feed(tm, data, len);
+        }
+
+        data += n;
+        len -= n;
+    }
+}
+
+void token_manager_rx_bytes(struct token_manager *tm, const uint8_t *data, size_t len)
+{
+    /* The bytes may end in a plain token, to pass on fast once those ahead are handled */
+    size_t tail = tm->cfg.fast_pass ? MIN(len, TM_TOKEN_FRAME_LEN) : 0;
+
+    tm_rx_feed(tm, data, len - tail);
+    if (tail > 0 && !token_manager_rx_fast(tm, &data[len - tail], tail)) {
+        tm_rx_feed(tm, &data[len - tail], tail);
+    }
+}
+
+/* A hold on token tok would send nothing and pass the token on unchanged */
+static bool tm_fast_idle(struct token_manager *tm, uint8_t tok)
+{
+    if (!tm_mpsc_is_empty(&tm->tx_q) || tm->tx_pending != NULL ||
+        atomic_get(&tm->mbox_dirty) != 0 || tm->seen_pending_n > 0) {
+        return false;
+    }
+    if (tok > 0) {
+        return true;
+    }
+
+    /* Token 0 also carries diagnostics, process data and the clock; ours sets up fields */
+    return k_msgq_num_used_get(&tm->diag_q) == 0 && !tm->pd_tx_pending &&
+           !tm->cfg.clock_sync &&
+           !(tm->cfg.start_node && (tm->cfg.agg_fields > 0 || tm->cfg.telemetry_nodes > 0));
+}
+
+bool token_manager_rx_fast(struct token_manager *tm, const uint8_t *data, size_t len)
+{
+    /* The decoder may hold the start of the token, from earlier RX chunks */
+    size_t head = tm->dec.pos;
+    uint8_t frame[TM_TOKEN_FRAME_LEN];
+    uint8_t token_id;
+    uint8_t tok;
+    uint32_t now;
+
+    /* Mid-frame, the bytes belong to the decoder; bad tokens are counted there */
+    if (tm->cfg.mac != TM_MAC_TOKEN || tm->pd_rx.pos > 0 || head + len != TM_TOKEN_FRAME_LEN ||
+        (head > 0 ? tm->dec.buf[0] : data[0]) != TM_TOKEN_DELIMITER) {
+        return false;
+    }
+
+    memcpy(frame, tm->dec.buf, head);
+    memcpy(&frame[head], data, len);
+    if (sys_get_be16(&frame[TM_TOKEN_HDR_LEN]) != tm_frame_crc(frame, TM_TOKEN_HDR_LEN)) {
+        return false;
+    }
+
+    token_id = frame[1];
+    tok = tm_token_index(tm, token_id);
+    if (!tm_fast_idle(tm, tok)) {
+        return false;
+    }
+
+    tm_frame_decoder_reset(&tm->dec);
+    tm->fast_passes++;
+    now = tm_now(tm);
+    TM_CAPTURE(tm->cfg.node_id, frame, sizeof(frame), 0);
+    TM_TRACE(tm->cfg.node_id, TM_TRACE_TOKEN_RX, token_id);
+
+    /* As tm_handle_token() and an empty hold would */
+    tm_rotation(tm, tok, now);
+    if (tm->cfg.start_tokens & BIT(tok)) {
+        token_id += tm->cfg.tokens;
+    }
+    tm->token_id = token_id;
+    tm->tokens[tok].id = token_id;
+    tm->agg_n = 0;
+    tm->telem_n = 0;
+    tm->seen_n = 0;
+
+    /* The port copies the frame before returning */
+    tm->tx_fast[1] = token_id;
+    sys_put_be16(tm_frame_crc(tm->tx_fast, TM_TOKEN_HDR_LEN), &tm->tx_fast[TM_TOKEN_HDR_LEN]);
+    int ret = tm_tx(tm, tm->tx_fast, TM_TOKEN_FRAME_LEN);
+    if (ret < 0) {
+        LOG_ERR("Hold TX failed: %d", ret);
+    }
+    tm_hist(tm, TM_HIST_HOLD, tm_now(tm) - now);
+
+    return true;
+}
+
+int token_manager_process_frame(struct token_manager *tm, const uint8_t *frame, size_t len)
+{
+    struct tm_frame f;
+    uint32_t rx_us = tm_now(tm);
+    int ret = tm_frame_decode(frame, len, &f);
+
+    TM_CAPTURE(tm->cfg.node_id, frame, len, ret);
+
+    if (ret < 0) {
+        /* RR-2: discard and wait for the next token */
+        TM_TRACE(tm->cfg.node_id, TM_TRACE_FRAME_DROP, -ret);
+        if (ret == -EBADMSG) {
+            tm->stats.crc_errors++;
+        }
+        LOG_WRN("Dropped invalid frame (%d)", ret);
+        return ret;
+    }
+
+    switch (f.type) {
+    case TM_FRAME_TOKEN:
+        tm_handle_token(tm, &f);
+        break;
+    case TM_FRAME_DATA:
+        tm_handle_data(tm, &f, frame, len, rx_us);
+        break;
+    case TM_FRAME_DIAG:
+        tm_handle_diag(tm, &f, frame, len, rx_us);
+        break;
+    case TM_FRAME_PDATA:
+        tm_handle_pdata(tm, &f, frame, len);
+        break;
+    case TM_FRAME_SLOT:
+        if (tm->cfg.mac == TM_MAC_SLOTTED) {
+            tm_handle_slot(tm, &f, frame, len, rx_us);
+        }
+        break;
+    case TM_FRAME_SYNC:
+        if (tm->cfg.mac == TM_MAC_TDMA) {
+            tm_handle_sync(tm, &f, rx_us);
+        } else if (tm->cfg.clock_sync) {
+            tm_handle_clock_sync(tm, &f);
+        }
+        break;
+    }
+
+#ifdef CONFIG_TOKEN_MANAGER_MAC_INSERTION
+    if (tm->cfg.mac == TM_MAC_INSERTION) {
+        tm_ins_poll(tm);
+    }
+#endif
+
+    return 0;
+}
+
+/* Map a pointer from token_manager_reserve() back to its slot */
+static struct token_manager_tx_slot *tm_slot_of(struct token_manager *tm, uint8_t *payload,
+                                                 uint8_t *idx)
+{
+    uintptr_t base = (uintptr_t)&tm->tx_slots[0].frame[TM_DATA_HDR_LEN];
+    uintptr_t off = (uintptr_t)payload - base;
+
+    /* Also rejects pointers below the first slot, which wrap around */
+    if (off % sizeof(tm->tx_slots[0]) != 0 ||
+        off / sizeof(tm->tx_slots[0]) >= ARRAY_SIZE(tm->tx_slots)) {
+        return NULL;
+    }
+
+    *idx = off / sizeof(tm->tx_slots[0]);
+
+    return &tm->tx_slots[*idx];
+}
+
+int token_manager_reserve(struct token_manager *tm, size_t len, uint8_t **payload)
+{
+    if (len > TM_MAX_PAYLOAD ||
+        (tm->cfg.mac == TM_MAC_SLOTTED && len > CONFIG_TOKEN_MANAGER_SLOT_SIZE)) {
+        return -EMSGSIZE;
+    }
+
+    for (int i = 0; i < CONFIG_TOKEN_MANAGER_TX_QUEUE_DEPTH; i++) {
+        if (atomic_test_and_clear_bit(tm->tx_free, i)) {
+            tm->tx_slots[i].reserved = (uint8_t)len;
+            *payload = &tm->tx_slots[i].frame[TM_DATA_HDR_LEN];
+            return 0;
+        }
+    }
+
+    return -ENOMEM;
+}
+
+int token_manager_commit(struct token_manager *tm, uint8_t *payload, size_t len)
+{
+    return token_manager_commit_to(tm, payload, len, TM_BROADCAST);
+}
+
+int token_manager_commit_to(struct token_manager *tm, uint8_t *payload, size_t len, uint8_t dst)
+{
+    uint8_t idx;
+    struct token_manager_tx_slot *slot = tm_slot_of(tm, payload, &idx);
+
+    if (slot == NULL || len > slot->reserved || dst == tm->cfg.node_id) {
+        return -EINVAL;
+    }
+
+    if (dst == TM_BROADCAST) {
+        tm_frame_finish_data(slot->frame, tm->cfg.node_id, len);
+    } else {
+        tm_frame_finish_addr(slot->frame, tm->cfg.node_id, dst, len);
+    }
+    tm_mpsc_push(&tm->tx_q, &slot->node);
+
+    return 0;
+}
+
+int token_manager_abort(struct token_manager *tm, uint8_t *payload)
+{
+    uint8_t idx;
+
+    if (tm_slot_of(tm, payload, &idx) == NULL) {
+        return -EINVAL;
+    }
+
+    atomic_set_bit(tm->tx_free, idx);
+
+    return 0;
+}
+
+int token_manager_send_data_frame(struct token_manager *tm, const uint8_t *payload, size_t len)
+{
+    return token_manager_send_to(tm, TM_BROADCAST, payload, len);
+}
+
+int token_manager_send_to(struct token_manager *tm, uint8_t dst, const uint8_t *payload,
+                          size_t len)
+{
+    uint8_t *buf;
+    int ret;
+
+    if (dst == tm->cfg.node_id) {
+        return -EINVAL;
+    }
+
+    ret = token_manager_reserve(tm, len, &buf);
+
+    if (ret == -ENOMEM) {
+        return -ENOMSG;
+    } else if (ret < 0) {
+        return ret;
+    }
+
+    if (len > 0) {
+        memcpy(buf, payload, len);
+    }
+
+    return token_manager_commit_to(tm, buf, len, dst);
+}
+
+int token_manager_mailbox_open(struct token_manager *tm, uint8_t type, uint8_t key)
+{
+    int free = -ENOMEM;
+
+    for (int i = 0; i < CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS; i++) {
+        const uint8_t *payload = &tm->mbox[i].frame[TM_DATA_HDR_LEN];
+
+        if (!(tm->mbox_used & BIT(i))) {
+            free = free < 0 ? i : free;
+        } else if (payload[0] == type && payload[1] == key) {
+            return i;
+        }
+    }
+
+    if (free >= 0) {
+        tm->mbox[free].frame[TM_DATA_HDR_LEN] = type;
+        tm->mbox[free].frame[TM_DATA_HDR_LEN + 1] = key;
+        atomic_clear(&tm->mbox[free].seq);
+        tm->mbox_used |= BIT(free);
+    }
+
+    return free;
+}
+
+int token_manager_mailbox_write(struct token_manager *tm, int handle, const uint8_t *value,
+                                size_t len)
+{
+    struct token_manager_mbox *mb;
+
+    if (handle < 0 || handle >= CONFIG_TOKEN_MANAGER_MAILBOX_SLOTS ||
+        !(tm->mbox_used & BIT(handle))) {
+        return -EINVAL;
+    }
+    if (len + 2 > CONFIG_TOKEN_MANAGER_MAILBOX_MAX_PAYLOAD) {
+        return -EMSGSIZE;
+    }
+
+    mb = &tm->mbox[handle];
+
+    /* Seqlock: an odd count tells the token manager to skip the slot */
+    atomic_inc(&mb->seq);
+    if (len > 0) {
+        memcpy(&mb->frame[TM_DATA_HDR_LEN + 2], value, len);
+    }
+    tm_frame_finish_data(mb->frame, tm->cfg.node_id, len + 2);
+    atomic_inc(&mb->seq);
+
+    atomic_set_bit(&tm->mbox_dirty, handle);
+
+    return 0;
+}
+
+int token_manager_pdata_send(struct token_manager *tm, const uint8_t *datagram, size_t len)
+{
+    if (len > CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN) {
+        return -EMSGSIZE;
+    }
+    if (tm->pd_tx_pending) {
+        return -EBUSY;
+    }
+
+    if (len > 0) {
+        memcpy(tm->pd_tx, datagram, len);
+    }
+    tm->pd_tx_len = (uint8_t)len;
+    tm->pd_tx_pending = true;
+
+    return 0;
+}
+
+int token_manager_agg_set(struct token_manager *tm, uint8_t field, int32_t value)
+{
+    if (field >= TM_AGG_MAX_FIELDS) {
+        return -EINVAL;
+    }
+
+    atomic_set(&tm->agg_value[field], value);
+    atomic_set_bit(&tm->agg_set, field);
+
+    return 0;
+}
+
+int token_manager_agg_clear(struct token_manager *tm, uint8_t field)
+{
+    if (field >= TM_AGG_MAX_FIELDS) {
+        return -EINVAL;
+    }
+
+    atomic_clear_bit(&tm->agg_set, field);
+
+    return 0;
+}
+
+int token_manager_agg_get(struct token_manager *tm, uint8_t field, int32_t *value)
+{
+    if (field >= TM_AGG_MAX_FIELDS) {
+        return -EINVAL;
+    }
+    if (!atomic_test_bit(&tm->agg_valid, field)) {
+        return -ENODATA;
+    }
+
+    *value = (int32_t)atomic_get(&tm->agg_result[field]);
+
+    return 0;
+}
+
+void token_manager_tx_done(struct token_manager *tm)
+{
+    if (atomic_get(&tm->clk_tx) == TM_CLK_TX_PENDING) {
+        tm->clk_tx_us = tm_now(tm);
+        atomic_set(&tm->clk_tx, TM_CLK_TX_DONE);
+    }
+    tm_release_inflight(tm);
+    atomic_clear(&tm->tx_gather_busy);
+}
+
+void token_manager_tick(struct token_manager *tm)
+{
+    uint32_t now = tm_now(tm);
+    /* Stagger by node ID so a single node regenerates the token (RR-3) */
+    uint32_t timeout = tm->cfg.token_timeout_us + tm->cfg.node_id * tm->cfg.regen_stagger_us;
+
+    if (tm->cfg.mac == TM_MAC_SLOTTED) {
+        if (tm->cfg.start_node && (now - tm->slot_rx_us) >= timeout) {
+            LOG_WRN("No slot for %u us, recreating", now - tm->slot_rx_us);
+            tm->stats.token_timeouts++;
+            tm->slot_rx_us = now;
+            tm_slots_create(tm);
+        }
+        return;
+    }
+    if (tm->cfg.mac == TM_MAC_INSERTION) {
+#ifdef CONFIG_TOKEN_MANAGER_MAC_INSERTION
+        tm_ins_poll(tm);
+#endif
+        return;
+    }
+    if (tm->cfg.mac == TM_MAC_TDMA) {
+        tm_tdma_tick(tm, now, timeout);
+        return;
+    }
+
+    /* Each token is watched on its own, so one loss leaves the others running */
+    for (uint8_t i = 0; i < tm->cfg.tokens; i++) {
+        struct token_manager_token *t = &tm->tokens[i];
+
+        if (tm->state != TM_STATE_IDLE || (now - t->last_us) < timeout) {
+            continue;
+        }
+
+        LOG_WRN("Token %u lost after %u us, regenerating", i, now - t->last_us);
+
+        tm_set_state(tm, TM_STATE_ERROR_RECOVERY);
+        tm->stats.token_timeouts++;
+        t->id += tm->cfg.tokens;
+        t->last_us = now;
+        tm->token_id = t->id;
+        TM_TRACE(tm->cfg.node_id, TM_TRACE_TOKEN_REGEN, tm->token_id);
+        if (i == 0) {
+            /* Accumulators of the lost token are gone; results resume a rotation later */
+            tm_agg_reset(tm);
+            tm_telem_reset(tm);
+        } else {
+            tm->agg_n = 0;
+            tm->telem_n = 0;
+        }
+        /* Reports of other nodes on the lost token are gone too */
+        tm_seen_pass(tm, NULL);
+        tm_hold_token(tm, i);
+    }
+}
+
+int token_manager_ring_time(struct token_manager *tm, uint32_t *ring_us, int32_t *drift_ppb)
+{
+    atomic_val_t seq;
+    bool synced;
+    uint32_t rx_us, now;
+    int32_t offset, drift;
+    int64_t since;
+
+    /* Copy the clock, again if the token manager updated it meanwhile */
+    do {
+        seq = atomic_get(&tm->clock_seq);
+        synced = tm->synced;
+        rx_us = tm->sync_rx_us;
+        offset = tm->sync_offset_us;
+        drift = tm->drift_ppb;
+        barrier_dmem_fence_full();
+    } while ((seq & 1) != 0 || atomic_get(&tm->clock_seq) != seq);
+
+    if (!synced) {
+        return -ENODATA;
+    }
+
+    now = tm_now(tm);
+    since = (int32_t)(now - rx_us);
+    *ring_us = now + offset + (int32_t)(since * drift / NSEC_PER_SEC);
+    if (drift_ppb != NULL) {
+        *drift_ppb = drift;
+    }
+
+    return 0;
+}
+
+uint32_t token_manager_next_due_us(struct token_manager *tm)
+{
+    uint32_t now = tm_now(tm);
+    int32_t wait;
+
+    if (tm->cfg.mac != TM_MAC_TDMA || !tm->synced) {
+        return UINT32_MAX;
+    }
+
+    wait = (int32_t)(tm->tdma_next_us - tm_ring_clock(tm, now));
+    if (tm->cfg.start_node) {
+        wait = MIN(wait, (int32_t)(tm->sync_next_us - now));
+    }
+
+    return MAX(wait, 0);
+}
+
+/*
+ * A subscription to a source marks it in the source filter, one to a
+ * message type from any source marks the type in the type filter, and one
+ * to everything lets every frame through
+ */
+static void tm_rx_filter_update(struct token_manager *tm)
+{
+    tm->rx_src_filter = 0;
+    tm->rx_type_filter = 0;
+
+    for (int i = 0; i < ARRAY_SIZE(tm->subs); i++) {
+        const struct token_manager_sub *sub = &tm->subs[i];
+
+        if (!(tm->subs_used & BIT(i))) {
+            continue;
+        }
+        if (sub->src != TM_SUB_ANY) {
+            tm->rx_src_filter |= BIT(sub->src % TM_SUB_FILTER_BITS);
+        } else if (sub->type != TM_SUB_ANY) {
+            tm->rx_type_filter |= BIT(sub->type % TM_SUB_FILTER_BITS);
+        } else {
+            tm->rx_src_filter = UINT32_MAX;
+            return;
+        }
+    }
+}
+
+int token_manager_subscribe(struct token_manager *tm, int src, int type,
+                            token_manager_sub_cb_t cb, void *user_data)
+{
+    if (cb == NULL || src < TM_SUB_ANY || src > UINT8_MAX || type < TM_SUB_ANY ||
+        type > UINT8_MAX) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(tm->subs); i++) {
+        if (tm->subs_used & BIT(i)) {
+            continue;
+        }
+
+        tm->subs[i] = (struct token_manager_sub){
+            .src = src,
+            .type = type,
+            .cb = cb,
+            .user_data = user_data,
+        };
+        tm->subs_used |= BIT(i);
+        tm_rx_filter_update(tm);
+
+        return i;
+    }
+
+    return -ENOMEM;
+}
+
+int token_manager_unsubscribe(struct token_manager *tm, int handle)
+{
+    if (handle < 0 || handle >= ARRAY_SIZE(tm->subs) || !(tm->subs_used & BIT(handle))) {
+        return -EINVAL;
+    }
+
+    tm->subs_used &= ~BIT(handle);
+    tm_rx_filter_update(tm);
+
+    return 0;
+}
+
+void token_manager_rx_release(struct token_manager *tm, const struct token_manager_rx_view *view)
+{
+    struct token_manager_rx_buf *buf = &tm->rx_pool[view->buf];
+
+    if (atomic_dec(&buf->refs) == 1) {
+        atomic_set_bit(&tm->rx_free, view->buf);
+    }
+}
+
+void token_manager_stats_get(struct token_manager *tm, struct token_manager_stats *stats)
+{
+    *stats = tm->stats;
+
+    /* The port adds its own counts to the link-level fields */
+    if (tm->cfg.port.link_stats != NULL) {
+        tm->cfg.port.link_stats(tm->cfg.port.ctx, stats);
+    }
+}
+
+int token_manager_telemetry_get(struct token_manager *tm, uint8_t node, enum tm_telem_id id,
+                                struct tm_histogram_summary *summary)
+{
+#if TM_TELEM_HIST_NODES > 0
+    if (node >= TM_TELEM_HIST_NODES || id >= TM_TELEM_COUNT) {
+        return -EINVAL;
+    }
+
+    tm_hist_summarize(&tm->telem_hist[node][id], summary);
+
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
@@ -0,0 +1,949 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/timing/timing.h>
+
+#include "ring_sim.h"
+
+#define SIM_MAX_EVENTS      512
+#define SIM_ENQ_FIFO        256
+#define SIM_MAX_ROTATIONS   4096
+#define SIM_MAX_LATENCIES   8192
+#define SIM_MAX_GAPS        8192
+#define SIM_MAX_SENDS       8192
+#define SIM_MAX_HOPS        8192
+#define SIM_BITS_PER_BYTE   10
+#define SIM_MBOX_TYPE       0x5D
+
+struct sim_event {
+    bool used;
+    /* Completion of a gather write by node dst rather than a frame for it */
+    bool tx_done;
+    /* The last chunk of a plain token */
+    bool token_end;
+    uint8_t dst;
+    uint16_t len;
+    uint64_t at_ns;
+    uint8_t data[TM_MAX_FRAME_LEN];
+};
+
+struct sim_node {
+    struct token_manager tm;
+    uint8_t id;
+    int mbox;
+    uint64_t link_busy_ns;
+    /* When the node's CPU has finished preparing everything written so far */
+    uint64_t cpu_busy_ns;
+    /* Start of the last copied transfer, zero if a gather write followed it */
+    uint64_t copy_start_ns;
+    uint64_t next_arrival_ns;
+    /* Ready times of accepted frames, matched in order at the next hop */
+    uint32_t enq_us[SIM_ENQ_FIFO];
+    uint32_t enq_seq;
+    uint32_t rx_seq;
+    uint64_t rx_bytes;
+    /* Clock rate error and reading at simulated time zero */
+    int32_t clock_ppm;
+    uint32_t clock_start_us;
+    /* Rotations seen so far, and when the last one let the node send */
+    uint32_t rotations;
+    uint64_t send_ns;
+    /* When the thread last woken for received bytes runs, and may write */
+    uint64_t rx_ready_ns;
+    /* Arrival of a plain token not yet passed on, zero once other frames went first */
+    uint64_t token_rx_ns;
+};
+
+static struct {
+    const struct ring_sim_config *cfg;
+    uint64_t now_ns;
+    uint64_t byte_ns_x1000;
+    struct sim_node nodes[RING_SIM_MAX_NODES];
+    struct sim_event events[SIM_MAX_EVENTS];
+    uint32_t rotation_samples[SIM_MAX_ROTATIONS];
+    uint32_t n_rotations;
+    uint32_t latency_samples[SIM_MAX_LATENCIES];
+    uint32_t n_latencies;
+    uint32_t gap_samples[SIM_MAX_GAPS];
+    uint32_t n_gaps;
+    uint32_t send_samples[SIM_MAX_SENDS];
+    uint32_t n_sends;
+    uint32_t clock_samples[SIM_MAX_SENDS];
+    uint32_t n_clocks;
+    uint32_t hop_samples[SIM_MAX_HOPS];
+    uint32_t n_hops;
+    uint32_t pass_samples[SIM_MAX_HOPS];
+    uint32_t n_passes;
+    uint32_t fast_passes;
+    uint32_t hook_passes;
+    uint64_t rx_wake_ns;
+    uint64_t tx_setup_ns;
+    uint64_t line_frame_ns;
+    uint64_t line_idle_ns;
+    uint32_t hold_writes;
+    uint64_t cpu_cycles;
+    uint32_t offered;
+    uint32_t dropped;
+    uint32_t seen;
+    /* Data frames received by all nodes together when measurement started */
+    uint64_t rx_start;
+    bool measuring;
+} sim;
+
+static uint64_t sim_tx_time_ns(size_t len)
+{
+    return (len * sim.byte_ns_x1000) / 1000;
+}
+
+/* A node's own clock, or simulated time without one */
+static uint32_t sim_now_us(void *ctx)
+{
+    struct sim_node *node = ctx;
+    uint64_t ns = sim.now_ns;
+
+    if (node == NULL) {
+        return (uint32_t)(ns / NSEC_PER_USEC);
+    }
+
+    ns += (int64_t)sim.now_ns * node->clock_ppm / 1000000;
+
+    return (uint32_t)(ns / NSEC_PER_USEC) + node->clock_start_us;
+}
+
+/* Time on the wire of a sync frame, rounded up */
+static uint32_t sim_sync_us(const struct ring_sim_config *cfg)
+{
+    return DIV_ROUND_UP(TM_SYNC_FRAME_LEN * SIM_BITS_PER_BYTE * USEC_PER_SEC, cfg->baud);
+}
+
+/* Length of the frame at the start of buf, as the next node's deframer sees it */
+static size_t sim_frame_len(const uint8_t *buf, size_t len)
+{
+    size_t n = MIN(len, TM_MAX_FRAME_LEN);
+
+    if (buf[0] == TM_TOKEN_DELIMITER) {
+        n = TM_TOKEN_FRAME_LEN;
+    } else if (buf[0] == TM_SYNC_DELIMITER) {
+        n = TM_SYNC_FRAME_LEN;
+    } else if (buf[0] == TM_AGG_DELIMITER && len >= TM_AGG_HDR_LEN) {
+        n = TM_AGG_FRAME_LEN(buf[2]);
+    } else if (buf[0] == TM_SEEN_DELIMITER && len >= TM_SEEN_HDR_LEN) {
+        n = TM_SEEN_FRAME_LEN(buf[2], buf[3]);
+    } else if (buf[0] == TM_TELEM_DELIMITER && len >= TM_TELEM_HDR_LEN) {
+        n = TM_TELEM_FRAME_LEN(buf[2], buf[3], buf[4]);
+    } else if (buf[0] == TM_DATA_DELIMITER && len >= TM_DATA_HDR_LEN) {
+        n = TM_DATA_FRAME_LEN(buf[2]);
+    } else if (buf[0] == TM_ADDR_DELIMITER && len >= TM_DATA_HDR_LEN) {
+        n = TM_ADDR_FRAME_LEN(buf[2]);
+    } else if (buf[0] == TM_DIAG_DELIMITER && len >= TM_DIAG_HDR_LEN) {
+        n = TM_DIAG_FRAME_LEN(buf[4]);
+    } else if (buf[0] == TM_PDATA_DELIMITER && len >= TM_PDATA_HDR_LEN) {
+        n = TM_PDATA_FRAME_LEN(buf[3]);
+    } else if (buf[0] == TM_SLOT_DELIMITER) {
+        n = TM_SLOT_FRAME_LEN(CONFIG_TOKEN_MANAGER_SLOT_SIZE);
+    }
+
+    return MIN(n, len);
+}
+
+static void sim_record_gap(uint64_t gap_ns)
+{
+    if (sim.n_gaps < SIM_MAX_GAPS) {
+        sim.gap_samples[sim.n_gaps++] = (uint32_t)gap_ns;
+    }
+}
+
+/* Bytes of a frame of len bytes, from off, that arrive in one piece */
+static size_t sim_chunk_len(size_t off, size_t len)
+{
+    return sim.cfg->rx_chunk > 0 ? MIN(len - off, sim.cfg->rx_chunk) : len - off;
+}
+
+/*
+ * A write may carry several frames back to back; each frame, or each chunk
+ * of one, becomes its own event so the next node sees it as soon as its
+ * last byte is on the wire. Returns the frames, and their chunks in *chunks.
+ */
+static size_t sim_count_frames(const uint8_t *buf, size_t len, size_t *chunks)
+{
+    size_t frames = 0;
+
+    *chunks = 0;
+    for (size_t off = 0, n; off < len; off += n) {
+        n = sim_frame_len(&buf[off], len - off);
+        for (size_t c = 0; c < n; c += sim_chunk_len(c, n)) {
+            (*chunks)++;
+        }
+        frames++;
+    }
+
+    return frames;
+}
+
+/* Collect up to n unused events; returns how many were found */
+static size_t sim_alloc_events(struct sim_event **evt, size_t n)
+{
+    size_t found = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(sim.events) && found < n; i++) {
+        if (!sim.events[i].used) {
+            evt[found++] = &sim.events[i];
+        }
+    }
+
+    return found;
+}
+
+static int sim_write(struct sim_node *node, const uint8_t *buf, size_t len, bool in_place)
+{
+    struct sim_event *evt[SIM_MAX_EVENTS];
+    size_t chunks;
+    size_t frames = sim_count_frames(buf, len, &chunks);
+
+    if (sim_alloc_events(evt, chunks) < chunks) {
+        return -ENOMEM;
+    }
+
+    /* Preparation is serial on the CPU but overlaps earlier transfers */
+    uint64_t ready = MAX(sim.now_ns, node->rx_ready_ns);
+
+    if (!in_place) {
+        node->cpu_busy_ns = MAX(ready, node->cpu_busy_ns) + frames * sim.cfg->tx_prep_ns;
+        ready = node->cpu_busy_ns;
+    }
+
+    uint64_t idle_from = MAX(sim.now_ns, node->link_busy_ns);
+    uint64_t start;
+
+    if (!in_place && ready + sim.tx_setup_ns <= node->copy_start_ns) {
+        /* Copied before the pending transfer started, so it joins it (as in the HAL) */
+        start = node->link_busy_ns;
+        idle_from = start;
+    } else {
+        start = MAX(idle_from, ready) + sim.tx_setup_ns;
+        node->copy_start_ns = in_place ? 0 : start;
+    }
+
+    if (node->token_rx_ns != 0) {
+        if (buf[0] == TM_TOKEN_DELIMITER && sim.measuring && sim.n_passes < SIM_MAX_HOPS) {
+            /* Only the time on the node counts, not the wait for the line to clear */
+            sim.pass_samples[sim.n_passes++] =
+                (uint32_t)(start - MAX(idle_from, node->token_rx_ns));
+        }
+        node->token_rx_ns = 0;
+    }
+
+    enum token_manager_state state = token_manager_state_get(&node->tm);
+    bool hold = sim.measuring &&
+                (state == TM_STATE_DATA_TRANSMISSION || state == TM_STATE_TOKEN_FORWARDING);
+
+    if (hold) {
+        sim.hold_writes++;
+        sim.line_idle_ns += start - idle_from;
+        sim.line_frame_ns += sim_tx_time_ns(len);
+    }
+
+    size_t off = 0, i = 0;
+    while (off < len) {
+        size_t n = sim_frame_len(&buf[off], len - off);
+
+        if (hold) {
+            sim_record_gap(off == 0 ? start - idle_from : 0);
+        }
+
+        for (size_t c = 0; c < n; i++) {
+            size_t piece = sim_chunk_len(c, n);
+
+            node->link_busy_ns = start + sim_tx_time_ns(off + c + piece);
+
+            evt[i]->used = true;
+            evt[i]->tx_done = false;
+            evt[i]->token_end = buf[off] == TM_TOKEN_DELIMITER && n == TM_TOKEN_FRAME_LEN &&
+                                c + piece == n;
+            evt[i]->dst = (node->id + 1) % sim.cfg->nodes;
+            evt[i]->len = piece;
+            evt[i]->at_ns = node->link_busy_ns;
+            memcpy(evt[i]->data, &buf[off + c], piece);
+            c += piece;
+        }
+        off += n;
+    }
+
+    return 0;
+}
+
+static int sim_tx(void *ctx, const uint8_t *buf, size_t len)
+{
+    return sim_write(ctx, buf, len, false);
+}
+
+/* Each segment goes out as its own transfer, in place of chained DMA */
+static int sim_tx_gather(void *ctx, const struct token_manager_tx_seg *segs, size_t n)
+{
+    struct sim_node *node = ctx;
+    struct sim_event *evt[SIM_MAX_EVENTS];
+    size_t needed = 1;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t chunks;
+
+        sim_count_frames(segs[i].buf, segs[i].len, &chunks);
+        needed += chunks;
+    }
+    if (sim_alloc_events(evt, needed) < needed) {
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        sim_write(node, segs[i].buf, segs[i].len, true);
+    }
+
+    /* Claimed after the frames, so it is still free */
+    sim_alloc_events(evt, 1);
+    evt[0]->used = true;
+    evt[0]->tx_done = true;
+    evt[0]->dst = node->id;
+    evt[0]->len = 0;
+    evt[0]->at_ns = node->link_busy_ns;
+
+    return 0;
+}
+
+static void sim_rx(struct token_manager *tm, uint8_t src, const uint8_t *payload, size_t len,
+                   void *user_data)
+{
+    struct sim_node *node = user_data;
+    struct sim_node *origin = &sim.nodes[src];
+
+    /* Latency and goodput are measured at the first hop, or the destination */
+    if ((src + MAX(sim.cfg->dst_hops, 1)) % sim.cfg->nodes != node->id) {
+        return;
+    }
+
+    uint32_t ready_us;
+
+    if (sim.cfg->mailbox) {
+        memcpy(&ready_us, &payload[2], sizeof(ready_us));
+    } else if (sim.cfg->tokens > 1) {
+        memcpy(&ready_us, &payload[1], sizeof(ready_us));
+        origin->rx_seq++;
+    } else {
+        ready_us = origin->enq_us[origin->rx_seq % SIM_ENQ_FIFO];
+        origin->rx_seq++;
+    }
+
+    if (!sim.measuring) {
+        return;
+    }
+
+    origin->rx_bytes += len;
+    if (sim.n_latencies < SIM_MAX_LATENCIES) {
+        sim.latency_samples[sim.n_latencies++] = sim_now_us(NULL) - ready_us;
+    }
+}
+
+static void sim_seen(struct token_manager *tm, uint8_t dst, uint8_t frames, void *user_data)
+{
+    if (sim.measuring) {
+        sim.seen += frames;
+    }
+}
+
+static void sim_pd_slot(struct token_manager *tm, uint8_t *slot, size_t len, void *user_data)
+{
+    uint32_t now = sim_now_us(NULL);
+
+    memcpy(slot, &now, sizeof(now));
+}
+
+/* Node 0: sample the age of every slot, then send the next datagram */
+static void sim_pd_done(struct token_manager *tm, const uint8_t *datagram, size_t len,
+                        uint8_t wkc, void *user_data)
+{
+    static const uint8_t next[CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN];
+    uint32_t now = sim_now_us(NULL);
+
+    if (sim.measuring) {
+        sim.offered++;
+        if (wkc != sim.cfg->nodes) {
+            sim.dropped++;
+        }
+        for (size_t off = 0; off < len && sim.n_latencies < SIM_MAX_LATENCIES;
+             off += sim.cfg->pd_slot) {
+            uint32_t stamp;
+
+            memcpy(&stamp, &datagram[off], sizeof(stamp));
+            sim.latency_samples[sim.n_latencies++] = now - stamp;
+        }
+    }
+
+    token_manager_pdata_send(tm, next, len);
+}
+
+/* Data frames received, summed over the nodes */
+static uint64_t sim_frames_rx(void)
+{
+    uint64_t frames = 0;
+
+    for (uint8_t i = 0; i < sim.cfg->nodes; i++) {
+        frames += sim.nodes[i].tm.stats.frames_rx;
+    }
+
+    return frames;
+}
+
+static struct sim_event *sim_next_event(void)
+{
+    struct sim_event *next = NULL;
+
+    for (size_t i = 0; i < ARRAY_SIZE(sim.events); i++) {
+        struct sim_event *evt = &sim.events[i];
+
+        if (evt->used && (next == NULL || evt->at_ns < next->at_ns)) {
+            next = evt;
+        }
+    }
+
+    return next;
+}
+
+static struct sim_node *sim_next_arrival(void)
+{
+    struct sim_node *next = NULL;
+
+    if (sim.cfg->load_pct == 0) {
+        return NULL;
+    }
+
+    for (uint8_t i = 0; i < sim.cfg->nodes; i++) {
+        struct sim_node *node = &sim.nodes[i];
+
+        if (next == NULL || node->next_arrival_ns < next->next_arrival_ns) {
+            next = node;
+        }
+    }
+
+    return next;
+}
+
+/* Sample the time since the node could last send, if it has been able to again */
+static void sim_note_send(struct sim_node *node)
+{
+    if (node->tm.rotations == node->rotations) {
+        return;
+    }
+    node->rotations = node->tm.rotations;
+
+    if (sim.measuring && node->send_ns > 0 && sim.n_sends < SIM_MAX_SENDS) {
+        sim.send_samples[sim.n_sends++] = (uint32_t)((sim.now_ns - node->send_ns) /
+                                                     NSEC_PER_USEC);
+    }
+    node->send_ns = sim.now_ns;
+}
+
+/* Sample how far every synchronised node's ring time is off the master's clock */
+static void sim_note_clocks(void)
+{
+    uint32_t master = sim_now_us(&sim.nodes[0]);
+
+    for (uint8_t i = 1; i < sim.cfg->nodes && sim.n_clocks < SIM_MAX_SENDS; i++) {
+        uint32_t ring;
+
+        if (token_manager_ring_time(&sim.nodes[i].tm, &ring, NULL) == 0) {
+            sim.clock_samples[sim.n_clocks++] = (uint32_t)abs((int32_t)(ring - master));
+        }
+    }
+}
+
+/* Frames still in flight to the first hop count against the backlog */
+static void sim_top_up(struct sim_node *node)
+{
+    uint8_t backlog = sim.cfg->backlog_nodes == 0 || node->id < sim.cfg->backlog_nodes
+                          ? sim.cfg->backlog
+                          : 0;
+
+    while (node->enq_seq - node->rx_seq < backlog) {
+        if (ring_sim_send(node->id) != 0) {
+            break;
+        }
+    }
+}
+
+/* A TDMA node whose slot or sync frame is due */
+static void sim_tick(struct sim_node *node)
+{
+    timing_t start, end;
+
+    sim_top_up(node);
+
+    start = timing_counter_get();
+    token_manager_tick(&node->tm);
+    end = timing_counter_get();
+
+    sim_note_send(node);
+    if (sim.measuring) {
+        sim.cpu_cycles += timing_cycles_get(&start, &end);
+    }
+}
+
+static void sim_deliver(struct sim_event *evt)
+{
+    /* Received bytes stay put, as in a UART RX buffer, while the node's writes reuse evt */
+    static uint8_t data[TM_MAX_FRAME_LEN];
+    struct sim_node *node = &sim.nodes[evt->dst];
+    uint32_t rotations = node->tm.rotations;
+    uint16_t len = evt->len;
+    bool token_end = evt->token_end;
+    timing_t start, end;
+    uint32_t passes;
+    bool hook;
+
+    evt->used = false;
+
+    if (evt->tx_done) {
+        token_manager_tx_done(&node->tm);
+        if (sim.cfg->insertion) {
+            token_manager_tick(&node->tm);
+        }
+        return;
+    }
+
+    sim_top_up(node);
+    memcpy(data, evt->data, len);
+    if (token_end) {
+        node->token_rx_ns = sim.now_ns;
+    }
+
+    /* Nothing else runs on the node meanwhile, as in the HAL's RX hook */
+    start = timing_counter_get();
+    passes = node->tm.fast_passes;
+    hook = sim.cfg->fast_pass && node->rx_ready_ns <= sim.now_ns &&
+           token_manager_rx_fast(&node->tm, data, len);
+    if (!hook) {
+        /* Woken for them, unless still up for earlier bytes */
+        if (node->rx_ready_ns <= sim.now_ns) {
+            node->rx_ready_ns = sim.now_ns + sim.rx_wake_ns;
+        }
+        token_manager_rx_bytes(&node->tm, data, len);
+    }
+    end = timing_counter_get();
+
+    sim_note_send(node);
+
+    if (!sim.measuring) {
+        return;
+    }
+
+    sim.cpu_cycles += timing_cycles_get(&start, &end);
+    sim.fast_passes += node->tm.fast_passes - passes;
+    sim.hook_passes += hook;
+    if (token_end && sim.n_hops < SIM_MAX_HOPS) {
+        sim.hop_samples[sim.n_hops++] =
+            (uint32_t)timing_cycles_to_ns(timing_cycles_get(&start, &end));
+    }
+
+    if (node->id == 0 && node->tm.rotations != rotations &&
+        sim.n_rotations < SIM_MAX_ROTATIONS) {
+        sim.rotation_samples[sim.n_rotations++] = node->tm.rotation_us;
+    }
+}
+
+/* The TDMA node with the earliest slot or sync frame due, and when */
+static struct sim_node *sim_next_wake(uint64_t *at_ns)
+{
+    struct sim_node *next = NULL;
+
+    if (sim.cfg->tdma_cycle_us == 0) {
+        return NULL;
+    }
+
+    for (uint8_t i = 0; i < sim.cfg->nodes; i++) {
+        struct sim_node *node = &sim.nodes[i];
+        uint32_t due = token_manager_next_due_us(&node->tm);
+        uint64_t at = sim.now_ns + (uint64_t)due * NSEC_PER_USEC;
+
+        if (due != UINT32_MAX && (next == NULL || at < *at_ns)) {
+            next = node;
+            *at_ns = at;
+        }
+    }
+
+    return next;
+}
+
+int ring_sim_send(uint8_t id)
+{
+    static uint8_t payload[TM_MAX_PAYLOAD];
+    struct sim_node *node = &sim.nodes[id];
+    int ret;
+
+    if (sim.cfg->mailbox) {
+        /* Overwritten samples never arrive, so each carries its own ready time */
+        uint32_t now = sim_now_us(NULL);
+
+        memcpy(payload, &now, sizeof(now));
+        ret = token_manager_mailbox_write(&node->tm, node->mbox, payload,
+                                          sim.cfg->payload_len - 2);
+        if (ret == 0 && sim.cfg->insertion) {
+            token_manager_tick(&node->tm);
+        }
+        return ret;
+    }
+
+    if (sim.cfg->tokens > 1) {
+        uint32_t now = sim_now_us(NULL);
+
+        payload[0] = (uint8_t)node->enq_seq;
+        memcpy(&payload[1], &now, sizeof(now));
+    }
+
+    if (sim.cfg->dst_hops > 0) {
+        ret = token_manager_send_to(&node->tm, (id + sim.cfg->dst_hops) % sim.cfg->nodes,
+                                    payload, sim.cfg->payload_len);
+    } else {
+        ret = token_manager_send_data_frame(&node->tm, payload, sim.cfg->payload_len);
+    }
+
+    if (ret == 0) {
+        node->enq_us[node->enq_seq % SIM_ENQ_FIFO] = sim_now_us(NULL);
+        node->enq_seq++;
+        if (sim.cfg->insertion) {
+            token_manager_tick(&node->tm);
+        }
+    }
+
+    return ret;
+}
+
+static void sim_offer(struct sim_node *node, uint64_t interval_ns)
+{
+    node->next_arrival_ns += interval_ns;
+
+    if (sim.measuring) {
+        sim.offered++;
+    }
+
+    if (ring_sim_send(node->id) != 0 && sim.measuring) {
+        sim.dropped++;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void ring_sim_percentiles(uint32_t *samples, uint32_t n, struct ring_sim_percentiles *out)
+{
+    uint64_t sum = 0;
+
+    memset(out, 0, sizeof(*out));
+    if (n == 0) {
+        return;
+    }
+
+    qsort(samples, n, sizeof(samples[0]), cmp_u32);
+    for (uint32_t i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+
+    out->min = samples[0];
+    out->p50 = samples[(n - 1) * 50 / 100];
+    out->p90 = samples[(n - 1) * 90 / 100];
+    out->p99 = samples[(n - 1) * 99 / 100];
+    out->max = samples[n - 1];
+    out->mean = (uint32_t)(sum / n);
+}
+
+int ring_sim_run(const struct ring_sim_config *cfg, struct ring_sim_result *res)
+{
+    uint64_t frame_ns, interval_ns = 0;
+    uint64_t warmup_ns = (uint64_t)cfg->warmup_us * NSEC_PER_USEC;
+    uint64_t end_ns = warmup_ns + (uint64_t)cfg->duration_us * NSEC_PER_USEC;
+    /* Clocks are sampled evenly over the measurement, as many times as fit */
+    bool clocks = cfg->clock_sync || cfg->tdma_cycle_us > 0;
+    uint64_t clock_ns = warmup_ns;
+    uint64_t clock_step_ns = (uint64_t)cfg->duration_us * NSEC_PER_USEC /
+                             (SIM_MAX_SENDS / RING_SIM_MAX_NODES);
+
+    if (cfg->nodes < 2 || cfg->nodes > RING_SIM_MAX_NODES || cfg->baud == 0 ||
+        (cfg->dst_hops > 0 && cfg->dst_hops % cfg->nodes == 0)) {
+        return -EINVAL;
+    }
+    if (cfg->pd_slot > 0 && (cfg->pd_slot < sizeof(uint32_t) ||
+                             cfg->pd_slot * cfg->nodes > CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN)) {
+        return -EINVAL;
+    }
+    if (cfg->tokens > 1 && (cfg->payload_len < 1 + sizeof(uint32_t) || cfg->mailbox)) {
+        return -EINVAL;
+    }
+    if (cfg->slots > 0 && (cfg->payload_len > CONFIG_TOKEN_MANAGER_SLOT_SIZE ||
+                           cfg->tokens > 1 || cfg->pd_slot > 0)) {
+        return -EINVAL;
+    }
+    if (cfg->insertion && (cfg->slots > 0 || cfg->tokens > 1 || cfg->pd_slot > 0)) {
+        return -EINVAL;
+    }
+    if (cfg->tdma_cycle_us > 0 &&
+        (cfg->slots > 0 || cfg->insertion || cfg->tokens > 1 || cfg->pd_slot > 0 ||
+         cfg->tdma_cycle_us < sim_sync_us(cfg) + (uint64_t)cfg->tdma_slot_us * cfg->nodes)) {
+        return -EINVAL;
+    }
+    if ((cfg->clock_sync || cfg->telemetry_nodes > 0 || cfg->fast_pass) &&
+        (cfg->tdma_cycle_us > 0 || cfg->slots > 0 || cfg->insertion)) {
+        return -EINVAL;
+    }
+    if (cfg->mailbox && (cfg->payload_len < 2 + sizeof(uint32_t) ||
+                         cfg->payload_len > CONFIG_TOKEN_MANAGER_MAILBOX_MAX_PAYLOAD)) {
+        return -EINVAL;
+    }
+
+    memset(&sim, 0, sizeof(sim));
+    memset(res, 0, sizeof(*res));
+    sim.cfg = cfg;
+    sim.byte_ns_x1000 = (uint64_t)SIM_BITS_PER_BYTE * NSEC_PER_SEC * 1000 / cfg->baud;
+    sim.tx_setup_ns = (uint64_t)cfg->tx_setup_us * NSEC_PER_USEC;
+    sim.rx_wake_ns = (uint64_t)cfg->rx_wake_us * NSEC_PER_USEC;
+
+    frame_ns = sim_tx_time_ns(TM_DATA_FRAME_LEN(cfg->payload_len));
+    if (cfg->load_pct > 0) {
+        interval_ns = frame_ns * cfg->nodes * 100 / cfg->load_pct;
+    }
+
+    timing_init();
+    timing_start();
+
+    for (uint8_t i = 0; i < cfg->nodes; i++) {
+        struct sim_node *node = &sim.nodes[i];
+        struct token_manager_config tm_cfg = {
+            .node_id = i,
+            .start_node = (i == 0),
+            .tokens = cfg->tokens,
+            .mac = cfg->tdma_cycle_us > 0 ? TM_MAC_TDMA
+                   : cfg->insertion       ? TM_MAC_INSERTION
+                   : cfg->slots > 0       ? TM_MAC_SLOTTED
+                                          : TM_MAC_TOKEN,
+            .slots = cfg->slots,
+            .tdma_cycle_us = cfg->tdma_cycle_us,
+            .tdma_offset_us = sim_sync_us(cfg) + i * cfg->tdma_slot_us,
+            .clock_sync = cfg->clock_sync,
+            .telemetry_nodes = cfg->telemetry_nodes,
+            .fast_pass = cfg->fast_pass,
+            .port = {
+                .tx = sim_tx,
+                .tx_gather = cfg->tx_gather || cfg->insertion || cfg->clock_sync ? sim_tx_gather
+                                                                                 : NULL,
+                .now_us = sim_now_us,
+                .ctx = node,
+            },
+            .rx_cb = sim_rx,
+            .diag_cb = cfg->diag_cb,
+            .seen_cb = sim_seen,
+            .pd_offset = i * cfg->pd_slot,
+            .pd_len = cfg->pd_slot,
+            .pd_cb = cfg->pd_slot > 0 ? sim_pd_slot : NULL,
+            .pd_done_cb = sim_pd_done,
+            .pd_nodes = cfg->nodes,
+            .agg_fields = cfg->agg_fields,
+            .user_data = node,
+            .max_frames_per_hold = cfg->max_frames_per_hold,
+            /* No faults are injected; keep regeneration out of the way */
+            .token_timeout_us = UINT32_MAX / 4,
+        };
+
+        memcpy(tm_cfg.agg_ops, cfg->agg_ops, sizeof(tm_cfg.agg_ops));
+        for (uint8_t k = 1; k < cfg->tokens; k++) {
+            if (k * cfg->nodes / cfg->tokens == i) {
+                tm_cfg.start_tokens |= BIT(k);
+            }
+        }
+        node->id = i;
+        node->next_arrival_ns = interval_ns * i / cfg->nodes;
+        if (cfg->clock_ppm > 0 && i > 0) {
+            /* Alternately fast and slow, the last node by the full amount */
+            node->clock_ppm = (i % 2 ? 1 : -1) * cfg->clock_ppm * i / (cfg->nodes - 1);
+            node->clock_start_us = i * 7919;
+        }
+        int ret = token_manager_init(&node->tm, &tm_cfg);
+        if (ret < 0) {
+            return ret;
+        }
+        if (cfg->mailbox) {
+            node->mbox = token_manager_mailbox_open(&node->tm, SIM_MBOX_TYPE, i);
+        }
+    }
+
+    if (cfg->pd_slot > 0) {
+        static const uint8_t first[CONFIG_TOKEN_MANAGER_PDATA_MAX_LEN];
+
+        /* Node 0 has already passed the token on; this goes with the next hold */
+        token_manager_pdata_send(&sim.nodes[0].tm, first, cfg->pd_slot * cfg->nodes);
+    }
+
+    while (sim.now_ns < end_ns) {
+        struct sim_event *evt = sim_next_event();
+        struct sim_node *arrival = sim_next_arrival();
+        uint64_t wake_ns = 0;
+        struct sim_node *wake = sim_next_wake(&wake_ns);
+
+        if (!sim.measuring && sim.now_ns >= warmup_ns) {
+            sim.measuring = true;
+            sim.rx_start = sim_frames_rx();
+            if (cfg->on_measure != NULL) {
+                cfg->on_measure();
+            }
+        }
+
+        uint64_t next_ns = evt != NULL ? evt->at_ns : end_ns;
+
+        if (arrival != NULL) {
+            next_ns = MIN(next_ns, arrival->next_arrival_ns);
+        }
+        if (wake != NULL) {
+            next_ns = MIN(next_ns, wake_ns);
+        }
+
+        if (clocks && clock_ns < next_ns && clock_ns < end_ns) {
+            sim.now_ns = clock_ns;
+            sim_note_clocks();
+            clock_ns += clock_step_ns;
+        } else if (wake != NULL && (evt == NULL || wake_ns < evt->at_ns) &&
+            (arrival == NULL || wake_ns < arrival->next_arrival_ns)) {
+            sim.now_ns = wake_ns;
+            sim_tick(wake);
+        } else if (arrival != NULL && (evt == NULL || arrival->next_arrival_ns < evt->at_ns)) {
+            sim.now_ns = arrival->next_arrival_ns;
+            sim_offer(arrival, interval_ns);
+        } else if (evt != NULL) {
+            sim.now_ns = evt->at_ns;
+            sim_deliver(evt);
+        } else {
+            break;
+        }
+    }
+
+    timing_stop();
+
+    uint64_t measured_ns = sim.now_ns - MIN(sim.now_ns, warmup_ns);
+    for (uint8_t i = 0; i < cfg->nodes; i++) {
+        struct sim_node *node = &sim.nodes[i];
+
+        if (measured_ns > 0) {
+            res->goodput_bps[i] = (uint32_t)(node->rx_bytes * 8 * NSEC_PER_SEC / measured_ns);
+        }
+    }
+
+    uint64_t frames = sim_frames_rx() - sim.rx_start;
+
+    if (cfg->dst_hops == 0) {
+        /* Every other node received each one */
+        frames /= cfg->nodes - 1;
+    }
+    res->ring_frames = (uint32_t)frames;
+    res->ring_goodput_bps = (uint32_t)(frames * cfg->payload_len * 8 * USEC_PER_SEC /
+                                       cfg->duration_us);
+
+    res->rotations = sim.n_rotations;
+    res->offered = sim.offered;
+    res->dropped = sim.dropped;
+    res->seen = sim.seen;
+    res->delivered = sim.n_latencies;
+    if (measured_ns > 0) {
+        res->cpu_load_ppm = (uint32_t)(timing_cycles_to_ns(sim.cpu_cycles) * 1000000 /
+                                       (measured_ns * cfg->nodes));
+    }
+
+    ring_sim_percentiles(sim.rotation_samples, sim.n_rotations, &res->rotation_us);
+    ring_sim_percentiles(sim.latency_samples, sim.n_latencies, &res->latency_us);
+    ring_sim_percentiles(sim.gap_samples, sim.n_gaps, &res->frame_gap_ns);
+    ring_sim_percentiles(sim.send_samples, sim.n_sends, &res->send_interval_us);
+    ring_sim_percentiles(sim.clock_samples, sim.n_clocks, &res->clock_error_us);
+    ring_sim_percentiles(sim.hop_samples, sim.n_hops, &res->token_hop_ns);
+    ring_sim_percentiles(sim.pass_samples, sim.n_passes, &res->token_pass_ns);
+    res->fast_passes = sim.fast_passes;
+    res->hook_passes = sim.hook_passes;
+
+    res->hold_writes = sim.hold_writes;
+    if (sim.line_frame_ns > 0) {
+        res->line_util_ppm = (uint32_t)(sim.line_frame_ns * 1000000 /
+                                        (sim.line_frame_ns + sim.line_idle_ns));
+    }
+
+    return 0;
+}
+
+struct token_manager *ring_sim_node(uint8_t id)
+{
+    return &sim.nodes[id].tm;
+}
+
+uint32_t ring_sim_now_us(void)
+{
+    return sim_now_us(NULL);
+}
+
+void ring_sim_report_percentiles(const char *key, const struct ring_sim_percentiles *p)
+{
+    printk(RING_SIM_PERCENTILES_FMT("%s"), key, RING_SIM_PERCENTILES_ARGS(*p));
+}
+
+void ring_sim_report(const char *name, const struct ring_sim_config *cfg,
+                     const struct ring_sim_result *res)
+{
+    printk("BENCH {\"name\":\"%s\",\"nodes\":%u,\"baud\":%u,\"payload\":%u,\"load_pct\":%u,",
+           name, cfg->nodes, cfg->baud, cfg->payload_len, cfg->load_pct);
+    printk("\"rotations\":%u,", res->rotations);
+    ring_sim_report_percentiles("rotation_us", &res->rotation_us);
+    printk(",");
+    ring_sim_report_percentiles("latency_us", &res->latency_us);
+    printk(",\"goodput_bps\":[");
+    for (uint8_t i = 0; i < cfg->nodes; i++) {
+        printk("%s%u", i > 0 ? "," : "", res->goodput_bps[i]);
+    }
+    printk("],\"offered\":%u,\"delivered\":%u,\"dropped\":%u,\"cpu_load_ppm\":%u}\n",
+           res->offered, res->delivered, res->dropped, res->cpu_load_ppm);
+}
+
+void ring_sim_report_ring(const char *name, const struct ring_sim_config *cfg,
+                          const struct ring_sim_result *res, const char *fields, ...)
+{
+    va_list ap;
+
+    printk("BENCH {\"name\":\"%s\",\"nodes\":%u,\"payload\":%u,", name, cfg->nodes,
+           cfg->payload_len);
+    va_start(ap, fields);
+    vprintk(fields, ap);
+    va_end(ap);
+    printk("\"rotations\":%u,\"ring_goodput_bps\":%u,", res->rotations, res->ring_goodput_bps);
+    ring_sim_report_percentiles("rotation_us", &res->rotation_us);
+    printk(",");
+    ring_sim_report_percentiles("latency_us", &res->latency_us);
+    if (cfg->clock_ppm > 0) {
+        printk(",");
+        ring_sim_report_percentiles("send_interval_us", &res->send_interval_us);
+        printk(",");
+        ring_sim_report_percentiles("clock_error_us", &res->clock_error_us);
+    }
+    if (cfg->telemetry_nodes > 0) {
+        printk(",\"forward_us_p50\":[");
+        for (uint8_t i = 0; i < cfg->telemetry_nodes; i++) {
+            struct tm_histogram_summary fwd = {0};
+
+            token_manager_telemetry_get(&sim.nodes[0].tm, i, TM_TELEM_FORWARD, &fwd);
+            printk("%s%u", i > 0 ? "," : "", fwd.p50);
+        }
+        printk("]");
+    }
+    printk("}\n");
+}
+
+uint32_t ring_sim_line_bps(uint32_t baud, uint8_t payload_len)
+{
+    return baud / 10 * 8 * payload_len / TM_DATA_FRAME_LEN(payload_len);
+}
@@ -0,0 +1,252 @@
+/*
+ * Discrete-event simulation of a token ring built from real token manager
+ * instances. Each link is modelled as a serial line at a fixed baud rate
+ * (10 bit-times per byte); a frame is delivered to the next node once its
+ * last byte has been clocked out, or in chunks if so configured. Simulated time is virtual, so results are
+ * reproducible and independent of the host.
+ */
+
+#ifndef RING_SIM_H_
+#define RING_SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "token_manager.h"
+
+#define RING_SIM_MAX_NODES 32
+
+struct ring_sim_config {
+    uint8_t nodes;
+    uint32_t baud;
+    uint8_t payload_len;
+    /* Aggregate offered load in percent of the line rate, split evenly across nodes */
+    uint8_t load_pct;
+    uint32_t warmup_us;
+    uint32_t duration_us;
+    /* Optional: called once when measurement starts */
+    void (*on_measure)(void);
+    /* Optional: receives diagnostic responses for every node */
+    token_manager_diag_cb_t diag_cb;
+    /*
+     * Optional: keep this many frames queued or in flight at every node, so
+     * each hold has a full backlog to send. Independent of load_pct.
+     */
+    uint8_t backlog;
+    /* Keep the backlog at nodes below this ID only; zero means every node */
+    uint8_t backlog_nodes;
+    /* Zero selects the Kconfig default */
+    uint8_t max_frames_per_hold;
+    /*
+     * Idle line time before each UART transfer, modelling the DMA setup
+     * and TX_DONE turnaround of a separate uart_tx() call. As in the HAL, a
+     * copied write made before the node's pending transfer has started
+     * joins that transfer instead.
+     */
+    uint32_t tx_setup_us;
+    /*
+     * CPU time a node spends encoding or copying each frame it writes, in
+     * nanoseconds. A copied write can start only once all of its frames are
+     * prepared; frames sent in place by a gather write cost nothing.
+     */
+    uint32_t tx_prep_ns;
+    /*
+     * Offer the scatter-gather port. Each segment is its own transfer, as
+     * with back-to-back uart_tx() calls, and the token manager is told when
+     * the last one has gone out.
+     */
+    bool tx_gather;
+    /*
+     * Offer the load as periodic samples written to one mailbox slot per
+     * node instead of the FIFO queue, so unsent samples are overwritten.
+     * Latency is then the age of each delivered sample. The payload must
+     * fit a mailbox frame and hold a 4-byte timestamp after type and key.
+     */
+    bool mailbox;
+    /*
+     * Hand received bytes to the next node in chunks of at most this many
+     * bytes of a frame, as a UART RX buffer of that size would; zero
+     * delivers whole frames.
+     */
+    uint8_t rx_chunk;
+    /*
+     * Exchange process data instead of offering load: node 0 sends a
+     * datagram of pd_slot bytes per node on every hold, and each node
+     * stamps its slot with the time the frame went by. Latency is then the
+     * age of each slot once the datagram is back at node 0, and frames
+     * returning with a short working counter are counted as dropped. Must
+     * hold a 4-byte timestamp.
+     */
+    uint8_t pd_slot;
+    /* Aggregation fields carried by the token, as in token_manager_config */
+    uint8_t agg_fields;
+    uint8_t agg_ops[TM_AGG_MAX_FIELDS];
+    /*
+     * Tokens circulating at once, as in token_manager_config; zero means
+     * one. Token k starts at node k * nodes / tokens. With more than one,
+     * frames cycle through the message types so every token has traffic,
+     * and carry their ready time after the type byte, as they no longer
+     * leave in order; the payload must hold both.
+     */
+    uint8_t tokens;
+    /*
+     * Address every frame to the node this many hops downstream, which
+     * strips it, instead of sending it round the ring; latency and goodput
+     * are then measured there. Zero sends ordinary data frames, measured
+     * at the first hop.
+     */
+    uint8_t dst_hops;
+    /*
+     * Run the slotted MAC with this many slots instead of a token. The
+     * payload must fit CONFIG_TOKEN_MANAGER_SLOT_SIZE.
+     */
+    uint8_t slots;
+    /*
+     * Run the register-insertion MAC instead of a token. The gather port
+     * is always offered, and a node's token manager is ticked whenever it
+     * queues a frame or finishes a transmission, as an application
+     * waking the token manager thread would.
+     */
+    bool insertion;
+    /*
+     * Run TDMA instead of a token, with cycles of tdma_cycle_us. Slots of
+     * tdma_slot_us follow the sync frame in node order, and the rest of
+     * the cycle is left idle. A node's token manager is
+     * ticked whenever it has something due, as an application sleeping
+     * for token_manager_next_due_us() would.
+     */
+    uint32_t tdma_cycle_us;
+    uint32_t tdma_slot_us;
+    /*
+     * Let node clocks run fast or slow by up to this many parts per
+     * million, spread across the nodes, and start them apart. Node 0's
+     * clock keeps simulated time.
+     */
+    uint16_t clock_ppm;
+    /* Keep a ring time by sync frames carried with token 0; implies tx_gather */
+    bool clock_sync;
+    /* Telemetry slots on token 0, as in token_manager_config */
+    uint8_t telemetry_nodes;
+    /*
+     * Offer each received frame, or chunk of one, to
+     * token_manager_rx_fast() first, as the application's UART RX hook
+     * does, and to token_manager_rx_bytes() only if it is refused; that
+     * then passes a token ending the bytes fast too (fast_pass in
+     * token_manager_config)
+     */
+    bool fast_pass;
+    /*
+     * Time the token manager thread takes to wake for received bytes.
+     * Writes it makes for them wait that long, and while it is up the RX
+     * hook does not run; tokens the hook passes on do not wait.
+     */
+    uint32_t rx_wake_us;
+};
+
+struct ring_sim_percentiles {
+    uint32_t min;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+    uint32_t mean;
+};
+
+/* Percentiles as a "key":{...} JSON member, as a printk format and its arguments */
+#define RING_SIM_PERCENTILES_FMT(key)                                                              \
+    "\"" key "\":{\"min\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u,\"mean\":%u}"
+#define RING_SIM_PERCENTILES_ARGS(p) (p).min, (p).p50, (p).p90, (p).p99, (p).max, (p).mean
+
+struct ring_sim_result {
+    uint32_t rotations;
+    struct ring_sim_percentiles rotation_us;
+    /* Ready-to-send until fully received by the next node */
+    struct ring_sim_percentiles latency_us;
+    uint32_t goodput_bps[RING_SIM_MAX_NODES];
+    /*
+     * Data frames delivered during the measurement, each counted once: by
+     * its destination if addressed, otherwise as received by all the other
+     * nodes. Also their payload bit rate.
+     */
+    uint32_t ring_frames;
+    uint32_t ring_goodput_bps;
+    uint32_t offered;
+    uint32_t delivered;
+    uint32_t dropped;
+    /* Addressed frames reported back to their source by seen reports */
+    uint32_t seen;
+    /*
+     * Time between successive chances to send (token arrivals, or TDMA
+     * slots) at every node, and how far each other node's ring time was
+     * off node 0's clock, in either direction, sampled across the run
+     */
+    struct ring_sim_percentiles send_interval_us;
+    struct ring_sim_percentiles clock_error_us;
+    /* Token manager processing time per node, parts per million of wall time */
+    uint32_t cpu_load_ppm;
+    /*
+     * Host processing time of each plain token received, from its last
+     * bytes being handed in until the call returns with the token passed
+     * on, and how many tokens took the fast pass, and of those how many
+     * from the RX hook rather than the thread
+     */
+    struct ring_sim_percentiles token_hop_ns;
+    uint32_t fast_passes;
+    uint32_t hook_passes;
+    /*
+     * Simulated time a plain token spends at a node that sends nothing on
+     * it, from its last byte coming in until it starts to leave, less any
+     * wait for the node's line to finish earlier frames
+     */
+    struct ring_sim_percentiles token_pass_ns;
+    /*
+     * Line use during token holds, i.e. writes made while sending queued
+     * frames and the token; forwarded frames are not included. Port writes
+     * summed over all nodes, idle line time before each frame (from the
+     * end of the previous frame, or from token arrival for the first), and
+     * frame time over frame plus idle time in ppm.
+     */
+    uint32_t hold_writes;
+    struct ring_sim_percentiles frame_gap_ns;
+    uint32_t line_util_ppm;
+};
+
+int ring_sim_run(const struct ring_sim_config *cfg, struct ring_sim_result *res);
+
+/* Token manager of a simulated node; valid during and after a run */
+struct token_manager *ring_sim_node(uint8_t id);
+
+/*
+ * Queue one frame of the configured payload length at node id, as the load
+ * generator does. Returns the token manager's result.
+ */
+int ring_sim_send(uint8_t id);
+
+/* Current simulated time */
+uint32_t ring_sim_now_us(void);
+
+/* Emit one machine-readable result line ("BENCH {json}") on the console */
+void ring_sim_report(const char *name, const struct ring_sim_config *cfg,
+                     const struct ring_sim_result *res);
+
+/*
+ * Emit a BENCH line for a run measured by ring goodput. It carries the
+ * name, node count and payload, then fields (a printk format for further
+ * members, each followed by a comma), then rotations, ring goodput and
+ * the rotation and latency percentiles. With clock_ppm set it also
+ * carries the send interval and clock error, and with telemetry_nodes set
+ * each node's median forwarding delay as the start node has it.
+ */
+void ring_sim_report_ring(const char *name, const struct ring_sim_config *cfg,
+                          const struct ring_sim_result *res, const char *fields, ...);
+
+/* Payload bit rate of a line kept busy with data frames of payload_len bytes */
+uint32_t ring_sim_line_bps(uint32_t baud, uint8_t payload_len);
+
+/* Sort samples in place and summarise them */
+void ring_sim_percentiles(uint32_t *samples, uint32_t n, struct ring_sim_percentiles *out);
+
+/* Print percentiles as a "key":{...} JSON member, for BENCH lines */
+void ring_sim_report_percentiles(const char *key, const struct ring_sim_percentiles *p);
+
+#endif /* RING_SIM_H_ */
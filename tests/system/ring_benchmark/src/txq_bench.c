@@ -0,0 +1,201 @@
+/*
+ * TX queue benchmark: the token manager's lock-free MPSC queue against a
+ * k_msgq carrying the same descriptors, with 1, 4 and 8 producer threads.
+ *
+ * Each producer owns a few descriptors and re-queues one as soon as the
+ * consumer has handed it back. The consumer stands in for the token
+ * manager: on every simulated token arrival it drains everything pending
+ * and records the time from arrival until the first descriptor is in hand,
+ * i.e. until the first data byte could be handed to the UART.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/timing/timing.h>
+#include <zephyr/ztest.h>
+
+#include "ring_sim.h"
+#include "tm_mpsc.h"
+
+#define TXQ_MAX_PRODUCERS     8
+#define TXQ_DESC_PER_PRODUCER 4
+#define TXQ_DESCS             (TXQ_MAX_PRODUCERS * TXQ_DESC_PER_PRODUCER)
+#define TXQ_ENQUEUES          256
+#define TXQ_SAMPLES           (TXQ_MAX_PRODUCERS * TXQ_ENQUEUES)
+#define TXQ_STACK_SIZE        1024
+#define TXQ_PRIORITY          K_PRIO_PREEMPT(7)
+
+enum txq_impl {
+    TXQ_MPSC,
+    TXQ_MSGQ,
+};
+
+static const char *const impl_names[] = {
+    [TXQ_MPSC] = "mpsc",
+    [TXQ_MSGQ] = "k_msgq",
+};
+
+static const uint8_t producer_counts[] = {1, 4, 8};
+
+struct txq_desc {
+    struct tm_mpsc_node node;
+    /* Set by the producer while queued, cleared by the consumer */
+    atomic_t busy;
+    uint8_t id;
+};
+
+static struct txq_desc descs[TXQ_DESCS];
+static struct tm_mpsc mpsc;
+K_MSGQ_DEFINE(msgq, sizeof(uint8_t), TXQ_DESCS, 1);
+
+static K_THREAD_STACK_ARRAY_DEFINE(stacks, TXQ_MAX_PRODUCERS, TXQ_STACK_SIZE);
+static struct k_thread threads[TXQ_MAX_PRODUCERS];
+
+static enum txq_impl impl;
+static uint32_t enqueue_ns[TXQ_SAMPLES];
+static atomic_t n_enqueued;
+static uint32_t first_ns[TXQ_SAMPLES];
+static uint32_t n_first;
+static uint32_t n_consumed;
+
+static inline uint32_t txq_elapsed_ns(timing_t *start, timing_t *end)
+{
+    return (uint32_t)timing_cycles_to_ns(timing_cycles_get(start, end));
+}
+
+static void txq_producer(void *p1, void *p2, void *p3)
+{
+    struct txq_desc *own = &descs[POINTER_TO_UINT(p1) * TXQ_DESC_PER_PRODUCER];
+    uint32_t sent = 0;
+
+    while (sent < TXQ_ENQUEUES) {
+        struct txq_desc *d = NULL;
+        timing_t start, end;
+
+        for (int i = 0; i < TXQ_DESC_PER_PRODUCER; i++) {
+            if (atomic_cas(&own[i].busy, 0, 1)) {
+                d = &own[i];
+                break;
+            }
+        }
+        if (d == NULL) {
+            /* Everything in flight: wait for the next token */
+            k_yield();
+            continue;
+        }
+
+        start = timing_counter_get();
+        if (impl == TXQ_MPSC) {
+            tm_mpsc_push(&mpsc, &d->node);
+        } else {
+            /* Sized for every descriptor, so this never blocks */
+            k_msgq_put(&msgq, &d->id, K_NO_WAIT);
+        }
+        end = timing_counter_get();
+
+        enqueue_ns[atomic_inc(&n_enqueued)] = txq_elapsed_ns(&start, &end);
+        sent++;
+    }
+}
+
+static void txq_release(struct txq_desc *d)
+{
+    n_consumed++;
+    atomic_clear(&d->busy);
+}
+
+/* One token arrival: drain everything pending, as the token manager would */
+static void txq_token_arrival(void)
+{
+    timing_t start = timing_counter_get();
+    timing_t end;
+
+    if (impl == TXQ_MPSC) {
+        struct tm_mpsc_node *n = tm_mpsc_take_all(&mpsc);
+
+        end = timing_counter_get();
+        if (n == NULL) {
+            return;
+        }
+        while (n != NULL) {
+            struct tm_mpsc_node *next = n->next;
+
+            txq_release(CONTAINER_OF(n, struct txq_desc, node));
+            n = next;
+        }
+    } else {
+        uint8_t id;
+
+        if (k_msgq_get(&msgq, &id, K_NO_WAIT) != 0) {
+            return;
+        }
+        end = timing_counter_get();
+        do {
+            txq_release(&descs[id]);
+        } while (k_msgq_get(&msgq, &id, K_NO_WAIT) == 0);
+    }
+
+    if (n_first < ARRAY_SIZE(first_ns)) {
+        first_ns[n_first++] = txq_elapsed_ns(&start, &end);
+    }
+}
+
+static void txq_run(enum txq_impl which, uint8_t producers)
+{
+    struct ring_sim_percentiles enq, first;
+    uint32_t total = producers * TXQ_ENQUEUES;
+
+    impl = which;
+    atomic_set(&n_enqueued, 0);
+    n_first = 0;
+    n_consumed = 0;
+    tm_mpsc_init(&mpsc);
+    k_msgq_purge(&msgq);
+    for (int i = 0; i < TXQ_DESCS; i++) {
+        descs[i].id = i;
+        atomic_clear(&descs[i].busy);
+    }
+
+    timing_init();
+    timing_start();
+
+    for (uint8_t i = 0; i < producers; i++) {
+        k_thread_create(&threads[i], stacks[i], TXQ_STACK_SIZE, txq_producer,
+                        UINT_TO_POINTER(i), NULL, NULL, TXQ_PRIORITY, 0, K_NO_WAIT);
+    }
+
+    /* The test thread outranks the producers and plays the token manager */
+    while (n_consumed < total) {
+        k_sleep(K_TICKS(1));
+        txq_token_arrival();
+    }
+
+    for (uint8_t i = 0; i < producers; i++) {
+        k_thread_join(&threads[i], K_FOREVER);
+    }
+
+    timing_stop();
+
+    zassert_equal(atomic_get(&n_enqueued), total, "lost enqueues");
+    zassert_equal(n_consumed, total, "consumed %u of %u", n_consumed, total);
+
+    ring_sim_percentiles(enqueue_ns, total, &enq);
+    ring_sim_percentiles(first_ns, n_first, &first);
+
+    printk("BENCH {\"name\":\"tx_queue\",\"impl\":\"%s\",\"producers\":%u,\"enqueues\":%u,",
+           impl_names[which], producers, total);
+    ring_sim_report_percentiles("enqueue_ns", &enq);
+    printk(",");
+    ring_sim_report_percentiles("first_desc_ns", &first);
+    printk("}\n");
+}
+
+ZTEST(tx_queue_benchmark, test_producers)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(producer_counts); i++) {
+        txq_run(TXQ_MSGQ, producer_counts[i]);
+        txq_run(TXQ_MPSC, producer_counts[i]);
+    }
+}
+
+ZTEST_SUITE(tx_queue_benchmark, NULL, NULL, NULL, NULL, NULL);